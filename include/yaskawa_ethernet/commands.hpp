@@ -29,7 +29,12 @@
 #pragma once
 #include "types.hpp"
 
+#include <estd/view.hpp>
+
 #include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
 #include <vector>
 
 namespace dr {
@@ -78,6 +83,24 @@ struct ReadVars {
 	std::uint8_t count;
 };
 
+/// Read a sequence of variables from the robot into a caller supplied buffer.
+/**
+ * Like ReadVars<T>, but the values are decoded directly into `output`
+ * instead of into a newly allocated vector.
+ * The number of variables read is the size of `output`, which must be in the range [1, 255].
+ *
+ * The buffer must stay valid and must not be accessed until the command completes.
+ * If the command fails, the contents of the buffer are unspecified.
+ *
+ * See ReadVar<T> for a list of supported types.
+ */
+template<typename T>
+struct ReadVarsInto {
+	using Response = void;
+	std::uint8_t index;
+	estd::view<T> output;
+};
+
 /// Write a variable from the robot.
 /**
  * See ReadVar<T> for a list of supported types.
@@ -100,33 +123,38 @@ struct WriteVars {
 	std::vector<T> values;
 };
 
-using ReadUint8Var   = ReadVar   <std::uint8_t>;
-using ReadUint8Vars  = ReadVars  <std::uint8_t>;
-using WriteUint8Var  = WriteVar  <std::uint8_t>;
-using WriteUint8Vars = WriteVars <std::uint8_t>;
-
-using ReadInt16Var   = ReadVar   <std::int16_t>;
-using ReadInt16Vars  = ReadVars  <std::int16_t>;
-using WriteInt16Var  = WriteVar  <std::int16_t>;
-using WriteInt16Vars = WriteVars <std::int16_t>;
-
-using ReadInt32Var   = ReadVar   <std::int32_t>;
-using ReadInt32Vars  = ReadVars  <std::int32_t>;
-using WriteInt32Var  = WriteVar  <std::int32_t>;
-using WriteInt32Vars = WriteVars <std::int32_t>;
-
-using ReadFloat32Var   = ReadVar   <float>;
-using ReadFloat32Vars  = ReadVars  <float>;
-using WriteFloat32Var  = WriteVar  <float>;
-using WriteFloat32Vars = WriteVars <float>;
-
-using ReadPositionVar   = ReadVar   <Position>;
-using ReadPositionVars  = ReadVars  <Position>;
-using WritePositionVar  = WriteVar  <Position>;
-using WritePositionVars = WriteVars <Position>;
+using ReadUint8Var      = ReadVar      <std::uint8_t>;
+using ReadUint8Vars     = ReadVars     <std::uint8_t>;
+using ReadUint8VarsInto = ReadVarsInto <std::uint8_t>;
+using WriteUint8Var     = WriteVar     <std::uint8_t>;
+using WriteUint8Vars    = WriteVars    <std::uint8_t>;
+
+using ReadInt16Var      = ReadVar      <std::int16_t>;
+using ReadInt16Vars     = ReadVars     <std::int16_t>;
+using ReadInt16VarsInto = ReadVarsInto <std::int16_t>;
+using WriteInt16Var     = WriteVar     <std::int16_t>;
+using WriteInt16Vars    = WriteVars    <std::int16_t>;
+
+using ReadInt32Var      = ReadVar      <std::int32_t>;
+using ReadInt32Vars     = ReadVars     <std::int32_t>;
+using ReadInt32VarsInto = ReadVarsInto <std::int32_t>;
+using WriteInt32Var     = WriteVar     <std::int32_t>;
+using WriteInt32Vars    = WriteVars    <std::int32_t>;
+
+using ReadFloat32Var      = ReadVar      <float>;
+using ReadFloat32Vars     = ReadVars     <float>;
+using ReadFloat32VarsInto = ReadVarsInto <float>;
+using WriteFloat32Var     = WriteVar     <float>;
+using WriteFloat32Vars    = WriteVars    <float>;
+
+using ReadPositionVar      = ReadVar      <Position>;
+using ReadPositionVars     = ReadVars     <Position>;
+using ReadPositionVarsInto = ReadVarsInto <Position>;
+using WritePositionVar     = WriteVar     <Position>;
+using WritePositionVars    = WriteVars    <Position>;
 
 struct ReadFileList {
-	using Response = std::vector<std::string>;
+	using Response = FileList;
 	std::string type;
 };
 
@@ -135,12 +163,34 @@ struct ReadFile {
 	std::string name;
 };
 
+/// Read a file and pass the data to a sink as it arrives.
+/**
+ * The sink is invoked with each block of the file in order.
+ * The data is only valid for the duration of the call.
+ * If the sink returns an error, the download is aborted with that error.
+ */
+struct ReadFileStreaming {
+	using Response = void;
+	std::string name;
+	std::function<Result<void>(std::string_view data)> sink;
+};
+
 struct WriteFile {
 	using Response = void;
 	std::string name;
 	std::string data;
 };
 
+/// Write a file with data that is owned by the caller.
+/**
+ * The data must remain valid until the command finishes.
+ */
+struct WriteFileView {
+	using Response = void;
+	std::string name;
+	std::string_view data;
+};
+
 struct DeleteFile {
 	using Response = void;
 	std::string name;
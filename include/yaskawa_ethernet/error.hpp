@@ -45,6 +45,7 @@ namespace errc {
 		malformed_response  = 0x01,
 		command_failed      = 0x02,
 		unknown_request     = 0x03,
+		no_free_request_id  = 0x04,
 	};
 
 	inline std::error_code      make_error_code(errc_t code)      { return {code, yaskawa_category()}; }
@@ -29,10 +29,13 @@
 #pragma once
 #include "../udp/client.hpp"
 
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <cstdint>
+#include <optional>
 #include <string>
+#include <vector>
 
 namespace dr {
 namespace yaskawa {
@@ -80,6 +83,21 @@ class RpcServer {
 	/// Vector of services.
 	std::vector<std::unique_ptr<detail::RpcService>> services_;
 
+	/// Buffer for the status registers of the services.
+	/**
+	 * Large enough for every B variable, so it is never reallocated under a read that is still in flight.
+	 */
+	std::array<std::uint8_t, 256> statuses_{};
+
+	/// Prepared command to read the status registers into `statuses_`.
+	std::optional<udp::PreparedCommand<ReadUint8VarsInto>> read_statuses_;
+
+	/// The number of status registers read by `read_statuses_`.
+	std::size_t read_count_ = 0;
+
+	/// The number of services that were registered when the server was last started.
+	std::atomic<std::size_t> polled_services_{0};
+
 	/// If true, we're started. If false, we should stop ASAP.
 	std::atomic<bool> started_{false};
 
@@ -135,6 +153,10 @@ public:
 
 	/// Start the RPC server.
 	/**
+	 * Only the services that are registered when the server is started are polled.
+	 * Services added while the server is running are picked up when it is started again.
+	 * Without any services, nothing is polled.
+	 *
 	 * Does nothing if the RPC server is already started.
 	 * \return False if the RPC server was already started, true otherwise.
 	 */
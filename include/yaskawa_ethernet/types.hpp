@@ -32,8 +32,14 @@
 
 #include <array>
 #include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
 #include <ostream>
+#include <string>
+#include <string_view>
 #include <variant>
+#include <vector>
 
 namespace dr {
 namespace yaskawa {
@@ -58,6 +64,27 @@ struct Status {
 	bool alarm;
 	bool error;
 	bool servo_on;
+
+	bool operator==(Status const & other) const {
+		return step               == other.step
+			&& one_cycle          == other.one_cycle
+			&& continuous         == other.continuous
+			&& running            == other.running
+			&& speed_limited      == other.speed_limited
+			&& teach              == other.teach
+			&& play               == other.play
+			&& remote             == other.remote
+			&& teach_pendant_hold == other.teach_pendant_hold
+			&& external_hold      == other.external_hold
+			&& command_hold       == other.command_hold
+			&& alarm              == other.alarm
+			&& error              == other.error
+			&& servo_on           == other.servo_on;
+	}
+
+	bool operator!=(Status const & other) const {
+		return !(*this == other);
+	}
 };
 
 enum class VariableType {
@@ -293,6 +320,62 @@ public:
 	bool operator!=(Position const & other) const { return !(*this == other); }
 };
 
+/// List of file names, stored in a single buffer.
+/**
+ * The names are returned as views into the buffer,
+ * so they are only valid as long as the list exists and is not modified.
+ */
+class FileList {
+public:
+	/// Start and end offset of a name in the buffer.
+	struct Range {
+		std::uint32_t start;
+		std::uint32_t end;
+	};
+
+	/// Iterator over the names in the list.
+	class const_iterator {
+		FileList const * list_ = nullptr;
+		std::size_t index_ = 0;
+
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type        = std::string_view;
+		using difference_type   = std::ptrdiff_t;
+		using pointer           = std::string_view const *;
+		using reference         = std::string_view;
+
+		const_iterator() = default;
+		const_iterator(FileList const & list, std::size_t index) : list_{&list}, index_{index} {}
+
+		std::string_view operator*() const { return (*list_)[index_]; }
+		const_iterator & operator++() { ++index_; return *this; }
+		const_iterator operator++(int) { const_iterator result = *this; ++index_; return result; }
+
+		bool operator==(const_iterator const & other) const { return index_ == other.index_; }
+		bool operator!=(const_iterator const & other) const { return index_ != other.index_; }
+	};
+
+private:
+	std::string data_;
+	std::vector<Range> names_;
+
+public:
+	FileList() = default;
+	FileList(std::string data, std::vector<Range> names) : data_{std::move(data)}, names_{std::move(names)} {}
+
+	std::size_t size() const { return names_.size(); }
+	bool empty()       const { return names_.empty(); }
+
+	std::string_view operator[](std::size_t index) const {
+		Range range = names_[index];
+		return std::string_view{data_}.substr(range.start, range.end - range.start);
+	}
+
+	const_iterator begin() const { return {*this, 0}; }
+	const_iterator end()   const { return {*this, size()}; }
+};
+
 std::ostream & operator<<(std::ostream & stream, CoordinateSystem const & frame);
 std::ostream & operator<<(std::ostream & stream, PoseConfiguration const & configuration);
 std::ostream & operator<<(std::ostream & stream, PulsePosition const & position);
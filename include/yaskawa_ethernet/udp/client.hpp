@@ -30,48 +30,128 @@
 #include "../commands.hpp"
 #include "../error.hpp"
 #include "../types.hpp"
+#include "executor.hpp"
 #include "message.hpp"
-
+#include "prepared_command.hpp"
+#include "retransmit.hpp"
+#include "statistics.hpp"
+#include "trace.hpp"
+#include "impl/deadline_queue.hpp"
+#include "impl/session_pool.hpp"
+
+#include <asio/buffer.hpp>
+#include <asio/dispatch.hpp>
 #include <asio/io_service.hpp>
 #include <asio/ip/udp.hpp>
+#include <asio/strand.hpp>
 #include <asio/streambuf.hpp>
 
 #include <estd/result.hpp>
 
+#include <array>
 #include <chrono>
 #include <cstdint>
 #include <functional>
-#include <map>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 
 namespace dr {
 namespace yaskawa {
 namespace udp {
 
+namespace impl {
+	class ReceiveBatch;
+	class SendQueue;
+}
+
+/// Client for the UDP protocol of the robot controller.
+/**
+ * All I/O of the client runs on a strand, so the io_service may be run from multiple threads.
+ * Completion callbacks are always invoked on that strand.
+ *
+ * The high level functions (connect, close, sendCommand(s) and the file functions) may be called from any thread.
+ * If the calling thread is already running the strand the work starts right away, otherwise it is posted to the strand.
+ * Data referenced by a command (like the output of ReadVarsInto) must remain valid until the callback is invoked.
+ *
+ * The low level functions (request ID and handler management, socket access) must only be used from the strand.
+ */
 class Client {
 public:
-	using Socket   = asio::ip::udp::socket;
+	using Socket   = asio::basic_datagram_socket<asio::ip::udp, Executor>;
 	using ErrorCallback = std::function<void (Error error)>;
 
 	struct OpenRequest {
 		std::chrono::steady_clock::time_point start_time;
 		std::function<void (ResponseHeader const & header, std::string_view data)> on_reply;
+
+		/// The time the last message for the request was queued.
+		std::chrono::steady_clock::time_point send_time;
+
+		/// The number of messages sent for the request since the last response.
+		unsigned int transmissions = 0;
+
+		/// The command of the last message sent for the request.
+		CommandKey command{Division::robot, 0};
+
+		/// True if the request ID is allocated.
+		bool allocated = false;
+
+		/// True if a handler is registered for the request.
+		bool active = false;
 	};
 
-	using HandlerToken = std::map<std::uint8_t, OpenRequest>::iterator;
+	/// Token to remove a registered handler (the request ID).
+	using HandlerToken = std::uint8_t;
 
 	ErrorCallback on_error;
 
 private:
 	Socket socket_;
+
+	/// The next request ID to consider for allocation.
 	std::uint8_t request_id_ = 1;
-	std::unique_ptr<std::array<std::uint8_t, 512>> read_buffer_;
 
-	std::map<std::uint8_t, OpenRequest> requests_;
+	/// The number of allocated request IDs.
+	std::size_t ids_in_use_ = 0;
+
+	/// Buffers for reading all pending responses in one go.
+	std::unique_ptr<impl::ReceiveBatch> receive_batch_;
+
+	/// Outgoing messages, waiting to be sent together.
+	std::unique_ptr<impl::SendQueue> send_queue_;
+
+	/// True if a flush of the send queue is scheduled.
+	bool flush_pending_ = false;
+
+	/// Open requests, indexed directly by request ID.
+	std::array<OpenRequest, 256> requests_;
+
+	/// Memory pool for command sessions.
+	std::shared_ptr<impl::SessionPool> session_pool_;
+
+	/// Deadlines of all in-flight commands, serviced by a single timer.
+	impl::DeadlineQueue deadlines_;
+
+	/// Round trip time estimator for retransmitting idempotent reads, if enabled.
+	std::optional<impl::RttEstimator> read_rtt_;
+
+	/// Round trip time estimator over all responses, for statistics.
+	impl::RttEstimator rtt_;
+
+	/// Counters and latency histograms, without the per-command latency.
+	ClientStatistics statistics_;
+
+	/// Latency histograms per command, indexed by division and command.
+	std::unordered_map<std::uint32_t, LatencyHistogram> command_latency_;
+
+	/// Receiver for trace events, or null if tracing is disabled at runtime.
+	Tracer * tracer_ = nullptr;
 
 public:
 	Client(asio::io_service & ios);
+	~Client();
 
 	/// Open a connection.
 	void connect(
@@ -93,21 +173,187 @@ public:
 	void close();
 
 	/// Get the executor used by the client.
-	asio::any_io_executor get_executor() { return socket_.get_executor(); }
+	/**
+	 * This is the strand that runs all handlers of the client.
+	 */
+	Executor get_executor() { return socket_.get_executor(); }
 
 	/// Get the socket used by the client.
 	Socket        & socket()       { return socket_; }
 	Socket const  & socket() const { return socket_; }
 
+	/// Get the memory pool used for command sessions.
+	std::shared_ptr<impl::SessionPool> const & sessionPool() { return session_pool_; }
+
+	/// Get the deadline queue used for command timeouts.
+	impl::DeadlineQueue & deadlines() { return deadlines_; }
+
+	/// Enable or disable retransmission of idempotent reads.
+	/**
+	 * When enabled, ReadVar, ReadVars, ReadVarsInto, ReadStatus and ReadCurrentPosition commands
+	 * that are not answered within the retransmission timeout are sent again with the same request ID,
+	 * up to `max_retries` times per command, and the first reply is accepted.
+	 * The deadline of the command still applies.
+	 *
+	 * This includes the reads of a sendCommands() request, and the ReadVars requests that coalesced reads are sent as.
+	 * Other commands in the same request are still sent only once.
+	 *
+	 * The retransmission timeout is derived from the round trip times of reads that were answered without retransmission,
+	 * and backs off exponentially for each retransmission of a command.
+	 *
+	 * Pass an empty optional to disable retransmission, which is the default.
+	 */
+	void setReadRetransmit(std::optional<RetransmitOptions> options);
+
+	/// Get the round trip time estimator for read retransmissions, or null if they are disabled.
+	impl::RttEstimator const * readRtt() const { return read_rtt_ ? &*read_rtt_ : nullptr; }
+
+	/// Process a round trip time measurement of a read that was not retransmitted.
+	void sampleReadRtt(std::chrono::steady_clock::duration rtt) {
+		if (read_rtt_) read_rtt_->sample(rtt);
+	}
+
+	/// Get a snapshot of the statistics of the client.
+	/**
+	 * The round trip time and latency are measured from the moment a message is queued until its response is processed.
+	 * Responses to retransmitted messages are counted in the latency histograms,
+	 * but not in the round trip time estimate (Karn's algorithm).
+	 *
+	 * Must only be called from the strand of the client.
+	 * Use the overload taking a callback from other threads.
+	 */
+	ClientStatistics statistics() const;
+
+	/// Get a snapshot of the statistics of the client from any thread.
+	/**
+	 * The snapshot is taken on the strand of the client and passed to `callback` there.
+	 */
+	void statistics(std::function<void(ClientStatistics)> callback);
+
+	/// Mark the next message for a request ID as a new request instead of a retransmission.
+	/**
+	 * For senders that re-use a request ID for a series of requests, like a Subscription.
+	 * Without this, an unanswered request would make the next one count as a retransmission,
+	 * and exclude its round trip time from the estimate.
+	 *
+	 * Must only be called from the strand of the client.
+	 */
+	void beginRequest(std::uint8_t request_id) {
+		requests_[request_id].transmissions = 0;
+	}
+
+	/// Count a command that failed because its deadline expired.
+	/**
+	 * Called by command sessions, must only be called from the strand of the client.
+	 */
+	void recordTimeout(std::uint8_t request_id) {
+		++statistics_.timeouts;
+		trace(TraceEvent::timeout, request_id);
+	}
+
+	/// Set the tracer that receives events from the hot path, or null to stop tracing.
+	/**
+	 * The tracer must remain valid until it is replaced or the client is destroyed.
+	 * Has no effect unless the library is built with tracing enabled (see trace_enabled).
+	 */
+	void setTracer(Tracer * tracer);
+
+	/// Record a trace event spanning a time range.
+	/**
+	 * Compiles to nothing if tracing is disabled at compile time.
+	 * Must only be called from the strand of the client.
+	 */
+	void trace(TraceEvent event, std::uint8_t request_id, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+		if constexpr (trace_enabled) {
+			// A span that started before the tracer was set has no start time.
+			if (tracer_ && start != std::chrono::steady_clock::time_point{}) tracer_->record({event, request_id, requests_[request_id].command, start, end});
+		}
+	}
+
+	/// Record an instantaneous trace event.
+	void trace(TraceEvent event, std::uint8_t request_id) {
+		if constexpr (trace_enabled) {
+			if (tracer_) {
+				std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+				tracer_->record({event, request_id, requests_[request_id].command, now, now});
+			}
+		}
+	}
+
+	/// Get the current time for a spanning trace event, or a default time point if tracing is disabled.
+	std::chrono::steady_clock::time_point traceNow() const {
+		if constexpr (trace_enabled) {
+			if (tracer_) return std::chrono::steady_clock::now();
+		}
+		return {};
+	}
+
+	/// Queue a message to be sent.
+	/**
+	 * Messages queued from the same handler are sent together after the handler returns,
+	 * with a single system call where the platform supports it.
+	 *
+	 * The buffers must remain valid until `on_error` is destroyed.
+	 * The queue holds on to it until the message has been sent.
+	 * If sending fails, `on_error` is invoked with the error.
+	 *
+	 * A sender that can not keep the buffers alive on its own (by capturing a shared pointer in `on_error`)
+	 * must pass an `owner` and call cancelSends() before the buffers or the captures of `on_error` are destroyed.
+	 */
+	void send(asio::const_buffer message, std::function<void(std::error_code)> on_error, void const * owner = nullptr) {
+		send(message, asio::const_buffer{}, std::move(on_error), owner);
+	}
+
+	/// Queue a message consisting of a header and a separate payload to be sent.
+	void send(asio::const_buffer header, asio::const_buffer payload, std::function<void(std::error_code)> on_error, void const * owner = nullptr);
+
+	/// Remove all messages of an owner that have not been sent yet, without invoking their error callbacks.
+	void cancelSends(void const * owner);
+
 	/// Register a handler for a request id.
+	/**
+	 * If the request ID was not allocated yet, it is allocated by registering the handler.
+	 */
 	HandlerToken registerHandler(std::uint8_t request_id, std::function<void(ResponseHeader const &, std::string_view)> handler);
 
-	/// Remove a handler for a request id.
+	/// Remove a handler for a request id and release the request ID.
 	void removeHandler(HandlerToken);
 
-	/// Alocate a request ID.
-	std::uint8_t allocateId() {
-		return request_id_++;
+	/// Remove a handler, but keep the request ID allocated for a while to absorb late replies.
+	/**
+	 * Used for requests that were retransmitted: a reply to an earlier transmission may still be underway,
+	 * and it must not be mistaken for the reply to a new request that re-uses the ID.
+	 *
+	 * Late replies are passed to `on_reply` if it is set, and ignored otherwise.
+	 */
+	void lingerHandler(HandlerToken, std::chrono::steady_clock::duration linger, std::function<void(ResponseHeader const &, std::string_view)> on_reply = nullptr);
+
+	/// Allocate a free request ID.
+	/**
+	 * Request IDs are handed out round-robin, skipping IDs that are still in use.
+	 * The ID stays in use until it is released with releaseId() or removeHandler().
+	 *
+	 * \return The allocated request ID, or an errc::no_free_request_id error if all request IDs are in use.
+	 */
+	Result<std::uint8_t> allocateId() {
+		return allocateIds(1);
+	}
+
+	/// Allocate a contiguous range of free request IDs.
+	/**
+	 * The range starts at the returned ID and may wrap around from 255 to 0.
+	 * Each ID in the range must be released individually.
+	 *
+	 * \return The first allocated request ID, or an errc::no_free_request_id error if no free range of the requested size exists.
+	 */
+	Result<std::uint8_t> allocateIds(std::size_t count);
+
+	/// Release an allocated request ID without a registered handler.
+	void releaseId(std::uint8_t request_id);
+
+	/// Get the number of request IDs that are currently in use.
+	std::size_t idsInUse() const {
+		return ids_in_use_;
 	}
 
 	/// Send a command.
@@ -122,6 +368,26 @@ public:
 		return sendCommand(std::forward<T>(command), std::chrono::steady_clock::now() + timeout, std::forward<Callback>(callback));
 	}
 
+	/// Send a prepared command.
+	/**
+	 * The prepared command is not encoded again, only its request ID is patched in a copy of the message.
+	 * The prepared command must remain valid and unmodified until the callback is invoked.
+	 */
+	template<typename T, typename Callback>
+	void sendCommand(PreparedCommand<T> const & command, std::chrono::steady_clock::time_point deadline, Callback && callback);
+
+	template<typename T, typename Callback>
+	void sendCommand(PreparedCommand<T> const & command, std::chrono::steady_clock::duration timeout, Callback && callback) {
+		return sendCommand(command, std::chrono::steady_clock::now() + timeout, std::forward<Callback>(callback));
+	}
+
+	/// Temporary prepared commands do not live long enough to be sent.
+	template<typename T, typename Callback>
+	void sendCommand(PreparedCommand<T> const && command, std::chrono::steady_clock::time_point deadline, Callback && callback) = delete;
+
+	template<typename T, typename Callback>
+	void sendCommand(PreparedCommand<T> const && command, std::chrono::steady_clock::duration timeout, Callback && callback) = delete;
+
 	template<typename Callback, typename... Commands>
 	void sendCommands(std::tuple<Commands...> commands, std::chrono::steady_clock::time_point deadline, Callback && callback);
 
@@ -133,7 +399,7 @@ public:
 	void readFileList(
 		std::string type,
 		std::chrono::milliseconds timeout,
-		std::function<void(Result<std::vector<std::string>>)> callback,
+		std::function<void(Result<FileList>)> callback,
 		std::function<void(std::size_t bytes_received)> on_progress
 	);
 
@@ -143,12 +409,68 @@ public:
 		std::function<void(Result<std::string>)> on_done,
 		std::function<void(std::size_t bytes_received)> on_progress
 	);
+
+	/// Download a file, passing each block to a sink as it arrives.
+	/**
+	 * Memory use does not depend on the size of the file.
+	 * The sink is invoked on the strand of the client, with data that is only valid during the call.
+	 * If the sink returns an error, the download is aborted and `on_done` receives the error.
+	 */
+	void readFileStreaming(
+		std::string name,
+		std::function<Result<void>(std::string_view data)> sink,
+		std::chrono::milliseconds timeout,
+		std::function<void(Result<void>)> on_done,
+		std::function<void(std::size_t bytes_received)> on_progress
+	);
+
+	/// Download a file, writing each block to a file descriptor as it arrives.
+	/**
+	 * The writes are blocking and run on the strand of the client,
+	 * so `fd` should refer to something that accepts data quickly, like a regular file or a pipe.
+	 * The file descriptor is not closed by the client.
+	 */
+	void readFileStreaming(
+		std::string name,
+		int fd,
+		std::chrono::milliseconds timeout,
+		std::function<void(Result<void>)> on_done,
+		std::function<void(std::size_t bytes_received)> on_progress
+	);
+
+	/// Upload a file to the controller.
+	/**
+	 * Blocks that are not acknowledged in time are retransmitted as configured by `retransmit`.
+	 * The timeout applies to the whole upload.
+	 *
+	 * The upload can not be resumed in a new session after it failed: the controller discards a partially written file.
+	 * The error message reports how many bytes were acknowledged.
+	 */
 	void writeFile(
 		std::string name,
 		std::string data,
 		std::chrono::milliseconds timeout,
 		std::function<void(Result<void>)> on_done,
-		std::function<void(std::size_t bytes_sent, std::size_t bytes_total)> on_progress
+		std::function<void(std::size_t bytes_sent, std::size_t bytes_total)> on_progress,
+		RetransmitOptions retransmit = {}
+	);
+
+	/// Upload the contents of a file descriptor to the controller.
+	/**
+	 * If `fd` refers to a regular file positioned at the start, the file is mapped into memory
+	 * and the blocks are sent straight from the mapping.
+	 * Otherwise the remaining data is read from the file descriptor before the upload starts.
+	 *
+	 * The file descriptor is only used during this call and may be closed afterwards.
+	 * A mapped file must not be truncated until `on_done` is invoked.
+	 */
+	void writeFile(
+		std::string name,
+		int fd,
+		std::chrono::milliseconds timeout,
+		std::function<void(Result<void>)> on_done,
+		std::function<void(std::size_t bytes_sent, std::size_t bytes_total)> on_progress,
+		RetransmitOptions retransmit = {}
 	);
 
 	void deleteFile(
@@ -158,14 +480,30 @@ public:
 	);
 
 private:
+	/// Run a function on the strand of the client.
+	/**
+	 * The function is invoked right away if the calling thread is running the strand,
+	 * otherwise it is posted to the strand.
+	 */
+	template<typename Function>
+	void dispatch(Function && function) {
+		asio::dispatch(get_executor(), impl::poolHandler(session_pool_, std::forward<Function>(function)));
+	}
+
 	/// Called when a connection attempt finishes.
 	void onConnect(Error, ErrorCallback callback);
 
-	/// Start an asynchronous receive.
+	/// Send all queued messages.
+	void flushSends();
+
+	/// Wait asynchronously for the socket to become readable.
 	void receive();
 
-	/// Process incoming messages.
-	void onReceive(std::error_code error, std::size_t message_size);
+	/// Read and process all pending messages.
+	void onReadable(std::error_code error);
+
+	/// Process an incoming message.
+	void onMessage(std::string_view message);
 };
 
 }}}
@@ -179,12 +517,23 @@ namespace udp {
 
 template<typename T, typename Callback>
 void Client::sendCommand(T command, std::chrono::steady_clock::time_point deadline, Callback && callback) {
-	impl::sendCommand(*this, std::move(command), deadline, std::forward<Callback>(callback));
+	dispatch([this, command = std::move(command), deadline, callback = std::forward<Callback>(callback)] () mutable {
+		impl::sendCommand(*this, std::move(command), deadline, std::move(callback));
+	});
+}
+
+template<typename T, typename Callback>
+void Client::sendCommand(PreparedCommand<T> const & command, std::chrono::steady_clock::time_point deadline, Callback && callback) {
+	dispatch([this, command = &command, deadline, callback = std::forward<Callback>(callback)] () mutable {
+		impl::sendCommand(*this, *command, deadline, std::move(callback));
+	});
 }
 
 template<typename Callback, typename... Commands>
 void Client::sendCommands(std::tuple<Commands...> commands, std::chrono::steady_clock::time_point deadline, Callback && callback) {
-	impl::sendMultipleCommands(*this, std::move(commands), deadline, std::forward<Callback>(callback));
+	dispatch([this, commands = std::move(commands), deadline, callback = std::forward<Callback>(callback)] () mutable {
+		impl::sendMultipleCommands(*this, std::move(commands), deadline, std::move(callback));
+	});
 }
 
 template<typename Commands>
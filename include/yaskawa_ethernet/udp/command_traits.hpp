@@ -26,6 +26,7 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#pragma once
 #include "./message.hpp"
 #include "../commands.hpp"
 
@@ -52,6 +53,7 @@ template<> struct encoded_size<TYPE> : size_constant<SIZE> {}; \
 template<> struct udp_command<ReadVar<TYPE>>   : command_constant<SINGLE>{}; \
 template<> struct udp_command<WriteVar<TYPE>>  : command_constant<SINGLE>{}; \
 template<> struct udp_command<ReadVars<TYPE>>   : command_constant<MULTI>{}; \
+template<> struct udp_command<ReadVarsInto<TYPE>> : command_constant<MULTI>{}; \
 template<> struct udp_command<WriteVars<TYPE>>  : command_constant<MULTI>{}
 
 VAR_TRAITS(std::uint8_t,      1, commands::robot::readwrite_int8_variable,           commands::robot::readwrite_multiple_int8);
@@ -64,10 +66,20 @@ VAR_TRAITS(Position,     13 * 4, commands::robot::readwrite_robot_position_varia
 template<typename Command> struct is_file_read_command : std::false_type{};
 template<> struct is_file_read_command<ReadFileList>  : std::true_type{};
 template<> struct is_file_read_command<ReadFile>      : std::true_type{};
+template<> struct is_file_read_command<ReadFileStreaming> : std::true_type{};
 
 /// If true, Command is a multi-part upload command.
 template<typename Command> struct is_file_write_command : std::false_type{};
-template<> struct is_file_read_command<WriteFile> : std::true_type{};
+template<> struct is_file_write_command<WriteFile>     : std::true_type{};
+template<> struct is_file_write_command<WriteFileView> : std::true_type{};
+
+/// If true, Command only reads data, so sending it more than once has no side effects.
+template<typename Command> struct is_idempotent_command : std::false_type{};
+template<> struct is_idempotent_command<ReadStatus>          : std::true_type{};
+template<> struct is_idempotent_command<ReadCurrentPosition> : std::true_type{};
+template<typename T> struct is_idempotent_command<ReadVar<T>>      : std::true_type{};
+template<typename T> struct is_idempotent_command<ReadVars<T>>     : std::true_type{};
+template<typename T> struct is_idempotent_command<ReadVarsInto<T>> : std::true_type{};
 
 /// If true, Command is a multi-part upload or download command.
 template<typename Command> struct is_file_command : bool_constant<false
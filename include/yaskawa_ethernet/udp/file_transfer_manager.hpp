@@ -0,0 +1,169 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "../types.hpp"
+#include "client.hpp"
+#include "retransmit.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+/// Settings for a FileTransferManager.
+struct FileTransferOptions {
+	/// Maximum number of file transfers that run at the same time.
+	std::size_t max_sessions = 4;
+
+	/// Maximum number of bytes held by running transfers.
+	/**
+	 * An upload holds the data of the whole file, a download holds one block since it is streamed to a sink.
+	 * A transfer that exceeds the budget on its own is started when no other transfer is running.
+	 */
+	std::size_t max_bytes_in_flight = 4 * 1024 * 1024;
+
+	/// Timeout for a single file transfer.
+	std::chrono::milliseconds timeout{30000};
+
+	/// Retransmission settings for uploads.
+	RetransmitOptions retransmit;
+};
+
+/// Runs multiple file transfers concurrently on one client.
+/**
+ * Each running transfer uses its own request ID.
+ * Transfers are started in the order they were added,
+ * as long as both the number of sessions and the byte budget allow it.
+ *
+ * All callbacks are invoked on the strand of the client.
+ * The functions to add transfers may be called from any thread.
+ * The manager must outlive all transfers added to it.
+ */
+class FileTransferManager {
+public:
+	using DoneCallback = std::function<void(Result<void>)>;
+
+	/// Called when the aggregate progress changes.
+	std::function<void(std::size_t bytes_transferred, std::size_t files_done, std::size_t files_total)> on_progress;
+
+	/// Called when the last queued transfer finished.
+	std::function<void()> on_idle;
+
+private:
+	/// A queued transfer.
+	struct Transfer {
+		/// The number of bytes the transfer counts against the byte budget.
+		std::size_t cost;
+
+		/// Start the transfer.
+		std::function<void(DoneCallback on_done, std::function<void(std::size_t bytes)> on_progress)> start;
+
+		/// Called when the transfer finished.
+		DoneCallback on_done;
+	};
+
+	Client * client_;
+	FileTransferOptions options_;
+
+	/// Transfers waiting to be started.
+	std::deque<Transfer> queue_;
+
+	/// The number of running transfers.
+	std::size_t active_ = 0;
+
+	/// The number of bytes held by running transfers.
+	std::size_t bytes_in_flight_ = 0;
+
+	/// Totals for the aggregate progress.
+	std::size_t bytes_transferred_ = 0;
+	std::size_t files_done_  = 0;
+	std::size_t files_total_ = 0;
+
+public:
+	explicit FileTransferManager(Client & client, FileTransferOptions options = {});
+
+	FileTransferManager(FileTransferManager const &) = delete;
+	FileTransferManager & operator=(FileTransferManager const &) = delete;
+
+	/// Queue a download, passing each block of the file to a sink.
+	void download(std::string name, std::function<Result<void>(std::string_view data)> sink, DoneCallback on_done);
+
+	/// Queue a download, writing the file to a file descriptor.
+	/**
+	 * The file descriptor must remain open until `on_done` is invoked.
+	 */
+	void download(std::string name, int fd, DoneCallback on_done);
+
+	/// Queue an upload of data in memory.
+	void upload(std::string name, std::string data, DoneCallback on_done);
+
+	/// Queue an upload of the contents of a file descriptor.
+	/**
+	 * The file descriptor is mapped when the transfer starts,
+	 * so it must remain open until `on_done` is invoked.
+	 *
+	 * Only regular files are supported, since other file descriptors would have to be read on the strand of the client.
+	 * For anything else `on_done` receives an std::errc::invalid_argument error.
+	 * Read the data yourself and use the upload with the data in memory instead.
+	 */
+	void upload(std::string name, int fd, DoneCallback on_done);
+
+	/// Get the settings of the manager.
+	FileTransferOptions const & options() const { return options_; }
+
+	/// Get the number of running transfers.
+	/**
+	 * Must only be called from the strand of the client.
+	 */
+	std::size_t activeTransfers() const { return active_; }
+
+	/// Get the number of bytes held by running transfers.
+	/**
+	 * Must only be called from the strand of the client.
+	 */
+	std::size_t bytesInFlight() const { return bytes_in_flight_; }
+
+private:
+	/// Queue a transfer on the strand of the client.
+	void enqueue(Transfer transfer);
+
+	/// Start queued transfers as long as the limits allow it.
+	void startTransfers();
+
+	/// Called when a running transfer finished.
+	void onTransferDone(std::size_t cost, DoneCallback const & on_done, Result<void> result);
+};
+
+}}}
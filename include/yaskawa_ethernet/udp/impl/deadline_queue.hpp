@@ -0,0 +1,204 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "../executor.hpp"
+#include "./session_pool.hpp"
+
+#include <asio/error.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+namespace impl {
+
+/// Deadlines for all in-flight requests of a client, serviced by a single timer.
+/**
+ * Deadlines are kept in a binary heap.
+ * The timer is only armed for the earliest deadline,
+ * and all deadlines that passed are expired in one batch when it fires.
+ *
+ * Cancelled deadlines are not removed from the heap right away.
+ * They are dropped when they reach the top of the heap,
+ * so cancelling a deadline never touches the timer.
+ *
+ * The queue is not thread-safe, it must only be used from the strand of the client.
+ */
+class DeadlineQueue {
+public:
+	using Clock     = std::chrono::steady_clock;
+	using TimePoint = Clock::time_point;
+
+	/// Token to cancel a deadline.
+	/**
+	 * A default constructed token does not refer to any deadline, cancelling it does nothing.
+	 */
+	struct Token {
+		std::uint32_t index      = std::numeric_limits<std::uint32_t>::max();
+		std::uint32_t generation = 0;
+	};
+
+private:
+	/// A scheduled deadline.
+	struct Entry {
+		std::function<void()> on_expire;
+		std::uint32_t generation = 0;
+	};
+
+	/// An element of the deadline heap.
+	struct HeapItem {
+		TimePoint deadline;
+		std::uint32_t index;
+		std::uint32_t generation;
+
+		/// Order heap items so that the earliest deadline is on top.
+		friend bool operator<(HeapItem const & a, HeapItem const & b) {
+			return a.deadline > b.deadline;
+		}
+	};
+
+	/// Timer for the earliest deadline.
+	SteadyTimer timer_;
+
+	/// Pool to allocate timer operations from.
+	std::shared_ptr<SessionPool> pool_;
+
+	/// Storage for scheduled deadlines.
+	std::vector<Entry> entries_;
+
+	/// Indices of unused entries.
+	std::vector<std::uint32_t> free_entries_;
+
+	/// Heap of scheduled (and possibly cancelled) deadlines.
+	std::vector<HeapItem> heap_;
+
+	/// The time the timer is armed for, or TimePoint::max() if it is not armed.
+	TimePoint armed_ = TimePoint::max();
+
+public:
+	DeadlineQueue(Executor executor, std::shared_ptr<SessionPool> pool) :
+		timer_{executor},
+		pool_{std::move(pool)} {}
+
+	DeadlineQueue(DeadlineQueue const &) = delete;
+	DeadlineQueue & operator=(DeadlineQueue const &) = delete;
+
+	/// Schedule a function to be called when a deadline expires.
+	Token add(TimePoint deadline, std::function<void()> on_expire) {
+		std::uint32_t index;
+		if (free_entries_.empty()) {
+			index = entries_.size();
+			entries_.emplace_back();
+		} else {
+			index = free_entries_.back();
+			free_entries_.pop_back();
+		}
+
+		Entry & entry = entries_[index];
+		entry.on_expire = std::move(on_expire);
+
+		heap_.push_back({deadline, index, entry.generation});
+		std::push_heap(heap_.begin(), heap_.end());
+
+		if (deadline < armed_) arm(deadline);
+		return {index, entry.generation};
+	}
+
+	/// Cancel a deadline.
+	/**
+	 * Does nothing if the deadline already expired or was cancelled.
+	 */
+	void cancel(Token token) {
+		if (token.index >= entries_.size()) return;
+		Entry & entry = entries_[token.index];
+		if (entry.generation != token.generation || !entry.on_expire) return;
+		release(token.index);
+	}
+
+private:
+	/// Free an entry and invalidate all tokens and heap items for it.
+	void release(std::uint32_t index) {
+		Entry & entry = entries_[index];
+		entry.on_expire = nullptr;
+		++entry.generation;
+		free_entries_.push_back(index);
+	}
+
+	/// Check if the heap item refers to a scheduled deadline.
+	bool isLive(HeapItem const & item) const {
+		return entries_[item.index].generation == item.generation;
+	}
+
+	/// Remove the top item from the heap.
+	HeapItem pop() {
+		std::pop_heap(heap_.begin(), heap_.end());
+		HeapItem item = heap_.back();
+		heap_.pop_back();
+		return item;
+	}
+
+	/// Arm the timer for the given time.
+	void arm(TimePoint time) {
+		armed_ = time;
+		timer_.expires_at(time);
+		timer_.async_wait(poolHandler(pool_, [this, time] (std::error_code error) {
+			if (error == asio::error::operation_aborted) return;
+			if (time != armed_) return;
+			armed_ = TimePoint::max();
+			expire();
+		}));
+	}
+
+	/// Expire all deadlines that passed and re-arm the timer for the next one.
+	void expire() {
+		TimePoint now = Clock::now();
+		while (!heap_.empty() && heap_.front().deadline <= now) {
+			HeapItem item = pop();
+			if (!isLive(item)) continue;
+			std::function<void()> on_expire = std::move(entries_[item.index].on_expire);
+			release(item.index);
+			on_expire();
+		}
+
+		// Drop cancelled deadlines so the timer is armed for a live one.
+		while (!heap_.empty() && !isLive(heap_.front())) pop();
+		if (!heap_.empty() && heap_.front().deadline < armed_) arm(heap_.front().deadline);
+	}
+};
+
+}}}}
@@ -27,10 +27,11 @@
  */
 
 #pragma once
+#include "../client.hpp"
+#include "./deadline_queue.hpp"
+
 #include <estd/result.hpp>
 
-#include <asio/io_service.hpp>
-#include <asio/steady_timer.hpp>
 #include <asio/error.hpp>
 
 #include <chrono>
@@ -49,28 +50,31 @@ public:
 	using result_type = typename Session::result_type;
 
 private:
-	/// Timer to interrupt the work session.
-	asio::steady_timer timer_;
+	/// The client whose deadline queue interrupts the work session.
+	Client * client_;
+
+	/// Token for the scheduled deadline.
+	DeadlineQueue::Token deadline_;
 
 	/// The session doing the real work.
 	Session work_;
 
 public:
 	template<typename ...Args>
-	DeadlineSession(asio::any_io_executor executor, Args && ...args) :
-		timer_{executor},
+	DeadlineSession(Client & client, Args && ...args) :
+		client_{&client},
 		work_(std::forward<Args>(args)...) {}
 
 	template<typename ...Args>
 	void start(std::chrono::steady_clock::time_point deadline, Args && ...args) {
-		work_.start(std::forward<Args>(args)...);
-
-		timer_.expires_at(deadline);
-		timer_.async_wait([this] (std::error_code error) {
-			if (error == asio::error::operation_aborted) return;
-			if (error) work_.resolve(estd::error{error, "waiting for timeout"});
+		// Schedule the deadline first: the work may resolve before start() returns,
+		// and then the completion handler cancels the deadline.
+		deadline_ = client_->deadlines().add(deadline, [this] () {
+			client_->recordTimeout(work_.requestId());
 			work_.resolve(estd::error{asio::error::timed_out});
 		});
+
+		work_.start(std::forward<Args>(args)...);
 	}
 
 	template<typename ...Args>
@@ -83,7 +87,7 @@ public:
 	}
 
 	void cancelTimeout() {
-		timer_.cancel();
+		client_->deadlines().cancel(deadline_);
 	}
 };
 
@@ -29,16 +29,23 @@
 #pragma once
 #include "../../error.hpp"
 #include "../client.hpp"
+#include "../command_traits.hpp"
+#include "../prepared_command.hpp"
 #include "../protocol.hpp"
+#include "../retransmit.hpp"
 #include "./deadline_session.hpp"
+#include "./session_pool.hpp"
 
-#include <asio/steady_timer.hpp>
 #include <asio/buffer.hpp>
+#include <asio/post.hpp>
+#include <asio/steady_timer.hpp>
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <system_error>
@@ -57,6 +64,9 @@ namespace impl {
  * - Read response data.
  *
  * It does not support timeouts directly, but it does have a cancel() method.
+ *
+ * If the client has read retransmission enabled, idempotent commands are sent again
+ * when they are not answered within the retransmission timeout.
  */
 template<typename Command>
 class CommandSession {
@@ -71,26 +81,63 @@ private:
 	std::function<void(result_type)> callback_;
 
 	Client::HandlerToken handler_;
+	std::shared_ptr<SessionPool> pool_;
 	std::vector<std::uint8_t> write_buffer_;
 
 	std::atomic_flag started_ = ATOMIC_FLAG_INIT;
 	std::atomic_flag done_    = ATOMIC_FLAG_INIT;
 
+	/// Retransmission timeout estimator, copied from the client when retransmission is enabled.
+	std::optional<RttEstimator> rtt_;
+
+	/// Token for the scheduled retransmission.
+	DeadlineQueue::Token retransmit_;
+
+	/// The number of times the command has been retransmitted.
+	unsigned int retries_ = 0;
+
+	/// The time the command was first sent.
+	std::chrono::steady_clock::time_point send_time_;
+
 public:
 	/// Construct a command session.
-	CommandSession(Client & client, Command command) :
+	/**
+	 * The request ID must have been allocated from the client.
+	 */
+	CommandSession(Client & client, std::uint8_t request_id, Command command) :
 		client_{&client},
-		request_id_{client.allocateId()},
-		command_{std::move(command)}
+		request_id_{request_id},
+		command_{std::move(command)},
+		pool_{client.sessionPool()},
+		write_buffer_{pool_->acquireBuffer()}
 	{
 		// Encode the command.
 		encode(write_buffer_, request_id_, command_);
 	}
 
+	/// Construct a command session for a prepared command.
+	/**
+	 * The encoded message is copied with the request ID patched in, the command is not encoded again.
+	 * The request ID must have been allocated from the client.
+	 */
+	CommandSession(Client & client, std::uint8_t request_id, PreparedCommand<Command> const & command) :
+		client_{&client},
+		request_id_{request_id},
+		command_{command.command()},
+		pool_{client.sessionPool()},
+		write_buffer_{pool_->acquireBuffer()}
+	{
+		command.encodeInto(write_buffer_, request_id_);
+	}
+
 	// Delete copy and move constructors, since we've posted callbacks with our address.
 	CommandSession(CommandSession const &) = delete;
 	CommandSession(CommandSession      &&) = delete;
 
+	~CommandSession() {
+		pool_->releaseBuffer(std::move(write_buffer_));
+	}
+
 	/// Start the session.
 	/**
 	 * By delaying start and taking the callback here,
@@ -102,55 +149,145 @@ public:
 
 		// Register the response handler.
 		handler_ = client_->registerHandler(request_id_, [this] (ResponseHeader const & header, std::string_view data) {
+			// Only measure the round trip time of commands that were sent once (Karn's algorithm).
+			if (rtt_ && retries_ == 0) client_->sampleReadRtt(std::chrono::steady_clock::now() - send_time_);
+
 			if (header.status != 0) {
 				resolve(commandFailed(header.status, header.extra_status));
 			} else {
-				resolve(decode(header, data, command_));
+				std::chrono::steady_clock::time_point decode_start = client_->traceNow();
+				result_type result = decode(header, data, command_);
+				client_->trace(TraceEvent::decode, request_id_, decode_start, client_->traceNow());
+				resolve(std::move(result));
 			}
 		});
 
 		// Write the command.
-		client_->socket().async_send(asio::buffer(write_buffer_.data(), write_buffer_.size()), [this] (std::error_code error, std::size_t) {
-			if (error) resolve(Error{error, "writing command for request " + std::to_string(request_id_)});
-		});
+		sendMessage();
+
+		if constexpr (is_idempotent_command<Command>::value) {
+			if (RttEstimator const * rtt = client_->readRtt()) {
+				rtt_       = *rtt;
+				send_time_ = std::chrono::steady_clock::now();
+				scheduleRetransmit();
+			}
+		}
 	}
 
 	void resolve(result_type result) {
 		if (done_.test_and_set()) return;
-		client_->removeHandler(handler_);
+		if (rtt_) client_->deadlines().cancel(retransmit_);
+
+		// A queued transmission refers to our write buffer and to us, which may be freed after the callback.
+		client_->cancelSends(this);
+
+		// Replies to earlier transmissions may still arrive, so keep the request ID reserved for a while.
+		if (retries_ > 0) {
+			client_->lingerHandler(handler_, rtt_->options().max_timeout);
+		} else {
+			client_->removeHandler(handler_);
+		}
+		std::chrono::steady_clock::time_point resolve_start = client_->traceNow();
 		callback_(result);
+		client_->trace(TraceEvent::resolve, request_id_, resolve_start, client_->traceNow());
+	}
+
+	/// Get the request ID used by the session.
+	std::uint8_t requestId() const {
+		return request_id_;
+	}
+
+private:
+	/// Queue the encoded command for sending.
+	void sendMessage() {
+		client_->send(asio::buffer(write_buffer_.data(), write_buffer_.size()), [this] (std::error_code error) {
+			resolve(Error{error, "writing command for request " + std::to_string(request_id_)});
+		}, this);
+	}
+
+	/// Send the command again if it isn't answered within the retransmission timeout.
+	void scheduleRetransmit() {
+		retransmit_ = client_->deadlines().add(std::chrono::steady_clock::now() + rtt_->timeout(), [this] () {
+			if (retries_ >= rtt_->options().max_retries) return;
+			++retries_;
+			rtt_->backoff();
+			sendMessage();
+			scheduleRetransmit();
+		});
 	}
 };
 
-/// Start a command session manages by a shared_ptr.
+/// A session with a deadline and a completion callback, allocated from the session pool of a client.
+template<typename Session, typename Callback>
+struct PooledSession {
+	/// The session doing the real work.
+	DeadlineSession<Session> session;
+
+	/// The callback to invoke when the session is done.
+	Callback callback;
+
+	/// Shared pointer to ourselves, keeping the session alive until the callback has been invoked.
+	std::shared_ptr<PooledSession> self;
+
+	template<typename... Args>
+	PooledSession(Client & client, Callback callback, Args && ... args) :
+		session(client, client, std::forward<Args>(args)...),
+		callback(std::move(callback)) {}
+};
+
+/// Start a session with a deadline, allocated from the session pool of the client.
 /**
- * The shared_ptr will be held internally by the session until it is ready to be destroyed,
+ * The session holds a shared_ptr to itself until it is ready to be destroyed,
  * so you do not need to keep your own copy alive.
  *
+ * The completion handler given to the session only holds raw pointers,
+ * so it fits in the small buffer of std::function.
+ * Together with the pooled memory, this means that starting a session doesn't allocate in the steady state.
+ *
  * \returns a shared_ptr to the created session.
  */
-template<typename Command, typename Callback>
-auto sendCommand(Client & client, Command command, std::chrono::steady_clock::time_point deadline, Callback callback) {
-	using Session = DeadlineSession<CommandSession<std::decay_t<Command>>>;
-	auto session = std::make_shared<Session>(client.get_executor(), client, std::move(command));
-	session->start(deadline, [&client, session, callback = std::move(callback)] (typename Session::result_type && result) mutable {
-		session->cancelTimeout();
-		std::move(callback)(std::move(result));
+template<typename Session, typename Callback, typename... Args>
+auto startPooledSession(Client & client, std::chrono::steady_clock::time_point deadline, Callback callback, Args && ... args) {
+	using Pooled = PooledSession<Session, Callback>;
+	auto pooled = std::allocate_shared<Pooled>(PoolAllocator<Pooled>{client.sessionPool()}, client, std::move(callback), std::forward<Args>(args)...);
+	pooled->self = pooled;
+	pooled->session.start(deadline, [&client, pooled = pooled.get()] (typename Session::result_type && result) {
+		pooled->session.cancelTimeout();
+		std::move(pooled->callback)(std::move(result));
 
 		// Move the shared_ptr into a posted handler which resets it.
-		// That way, any queued event handlers can still completer succesfully.
-		asio::post(client.get_executor(), [session = std::move(session)] () mutable {
-			session.reset();
+		// That way, any queued event handlers can still complete succesfully.
+		asio::post(client.get_executor(), poolHandler(client.sessionPool(), [self = std::move(pooled->self)] () mutable {
+			self.reset();
+		}));
+	});
+	return pooled;
+}
+
+/// Get the command type of a command or a prepared command.
+template<typename Command> struct unprepared                           { using type = Command; };
+template<typename Command> struct unprepared<PreparedCommand<Command>> { using type = Command; };
+
+/// Start a command session allocated from the session pool of the client.
+/**
+ * The command may be a PreparedCommand, which is taken by reference.
+ * If no request ID is available, the callback is invoked with an errc::no_free_request_id error.
+ *
+ * \returns a shared_ptr to the created session, or an empty shared_ptr if no request ID was available.
+ */
+template<typename Command, typename Callback>
+auto sendCommand(Client & client, Command && command, std::chrono::steady_clock::time_point deadline, Callback callback) {
+	using Session = CommandSession<typename unprepared<std::decay_t<Command>>::type>;
+
+	Result<std::uint8_t> request_id = client.allocateId();
+	if (!request_id) {
+		asio::post(client.get_executor(), [callback = std::move(callback), error = std::move(request_id.error_unchecked())] () mutable {
+			std::move(callback)(std::move(error));
 		});
+		return std::shared_ptr<PooledSession<Session, Callback>>{};
+	}
 
-		// Reset our own shared_ptr.
-		// Not really needed since we've moved out of it,
-		// but if the lambda is made non-mutable std::move silently doesn't move,
-		// and then we have a memory leak.
-		// This will make the compiler bark in that case.
-		session.reset();
-	});
-	return session;
+	return startPooledSession<Session>(client, deadline, std::move(callback), *request_id, std::forward<Command>(command));
 }
 
 }}}}
@@ -29,8 +29,10 @@
 #pragma once
 #include "./send_command.hpp"
 #include "./deadline_session.hpp"
+#include "../command_traits.hpp"
 #include "../../type_traits.hpp"
 
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <cstdint>
@@ -39,6 +41,7 @@
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 namespace dr {
 namespace yaskawa {
@@ -46,20 +49,85 @@ namespace udp {
 
 namespace impl {
 
+/// Traits to coalesce adjacent variable commands into a single request.
+/**
+ * By default, commands can not be coalesced.
+ */
+template<typename Command>
+struct coalesce_traits {
+	/// The command type for a coalesced group, or void.
+	using type = void;
+
+	/// The maximum number of commands in one group.
+	static constexpr std::size_t max_count = 1;
+
+	/// If true, the number of commands in a group must be even.
+	static constexpr bool even_count = false;
+
+	/// Get the variable index of a command.
+	static int index(Command const &) { return -1; }
+};
+
+/// Maximum number of variables in a multiple read or write request.
+/**
+ * The payload of the request or response holds a 32 bit count followed by the values,
+ * and the count itself is limited by the 8 bit count in ReadVars.
+ */
+template<typename T>
+constexpr std::size_t max_coalesced_count = std::min<std::size_t>(255, (max_payload_size - 4) / encoded_size<T>::value);
+
+template<typename T>
+struct coalesce_traits<ReadVar<T>> {
+	using type = ReadVars<T>;
+	static constexpr std::size_t max_count = max_coalesced_count<T>;
+	static constexpr bool even_count = std::is_same<T, std::uint8_t>::value;
+	static int index(ReadVar<T> const & command) { return command.index; }
+};
+
+template<typename T>
+struct coalesce_traits<WriteVar<T>> {
+	using type = WriteVars<T>;
+	static constexpr std::size_t max_count = max_coalesced_count<T>;
+	static constexpr bool even_count = std::is_same<T, std::uint8_t>::value;
+	static int index(WriteVar<T> const & command) { return command.index; }
+};
+
+template<typename Command>
+constexpr bool is_coalescable = !std::is_same<typename coalesce_traits<Command>::type, void>::value;
+
+/// Session to send a tuple of commands and collect the results.
+/**
+ * Adjacent commands in the tuple that read or write the same variable type
+ * with contiguous variable indices are coalesced into a single ReadVars or WriteVars request.
+ * The results of a coalesced read are scattered back into the result tuple.
+ */
 template<typename Commands>
 class MultiCommandSession {
 	constexpr static int Count = std::tuple_size<Commands>::value;
 
+	template<std::size_t I>
+	using command_t = std::tuple_element_t<I, Commands>;
+
 	/// Map a Command to the result_type (or Empty for void results).
 	template<typename Command>
 	struct response_tuple_element {
 		using type = map_type_t<typename Command::Response, void, Empty>;
 	};
 
-	/// Map a Command to an std::optional<CommandSession<Command>>.
+	/// Sessions for a command that may also be the first command of a coalesced group.
+	template<typename Command>
+	struct CoalescableSession {
+		std::optional<CommandSession<Command>> single;
+		std::optional<CommandSession<typename coalesce_traits<Command>::type>> group;
+	};
+
+	/// Map a Command to an std::optional<CommandSession<Command>>, or a CoalescableSession.
 	template<typename Command>
 	struct command_session_tuple_element {
-		using type = std::optional<CommandSession<Command>>;
+		using type = std::conditional_t<is_coalescable<Command>,
+			CoalescableSession<Command>,
+			std::optional<CommandSession<Command>>
+		>;
 	};
 
 	using CommandSessionsTuple = map_tuple_t<Commands, command_session_tuple_element>;
@@ -68,6 +136,15 @@ public:
 	using response_type  = map_tuple_t<Commands, response_tuple_element>;
 	using result_type    = Result<response_type>;
 
+	/// Plan for sending the commands.
+	struct Plan {
+		/// The number of commands in the group starting at each command, or 0 if the command is part of an earlier group.
+		std::array<std::uint8_t, Count> group_size;
+
+		/// The total number of requests to send.
+		std::size_t requests;
+	};
+
 private:
 	/// Sub-sessions.
 	CommandSessionsTuple sessions_;
@@ -75,6 +152,12 @@ private:
 	/// Result storage.
 	response_type result_;
 
+	/// The plan for sending the commands.
+	Plan plan_;
+
+	/// The request ID of the first command.
+	std::uint8_t first_request_id_;
+
 	std::atomic_flag started_ = ATOMIC_FLAG_INIT;
 	std::atomic_flag done_    = ATOMIC_FLAG_INIT;
 
@@ -82,8 +165,20 @@ private:
 	std::function<void(result_type)> callback_;
 
 public:
-	MultiCommandSession(Client & client, Commands && commands) {
-		init_sessions_<0>(client, std::move(commands));
+	/// Construct a multi-command session.
+	/**
+	 * The request IDs first_request_id up to first_request_id + plan.requests must have been allocated from the client.
+	 */
+	MultiCommandSession(Client & client, std::uint8_t first_request_id, Plan const & plan, Commands && commands) :
+		plan_{plan},
+		first_request_id_{first_request_id}
+	{
+		init_sessions_<0>(client, first_request_id, std::move(commands));
+	}
+
+	/// Plan which commands to coalesce into a single request.
+	static Plan plan(Commands const & commands) {
+		return makePlan_(commands, std::make_index_sequence<Count>{});
 	}
 
 public:
@@ -96,14 +191,28 @@ public:
 	template<std::size_t I>
 	auto callback() {
 		static_assert(I < Count, "command callback index exceeds valid range");
-		using Response = typename std::tuple_element_t<I, Commands>::Response;
+		using Response = typename command_t<I>::Response;
 
 		return [this] (Result<Response> result) {
 			if (!result) return resolve(result.error_unchecked());
 			if constexpr (std::is_same<Response, void>() == false) {
 				std::get<I>(result_) = std::move(*result);
 			}
-			if (++finished_commands_ == Count) resolve(Error{});
+			finished(1);
+		};
+	}
+
+	template<std::size_t I>
+	auto groupCallback() {
+		static_assert(I < Count, "command callback index exceeds valid range");
+		using Response = typename coalesce_traits<command_t<I>>::type::Response;
+
+		return [this] (Result<Response> result) {
+			if (!result) return resolve(result.error_unchecked());
+			if constexpr (std::is_same<Response, void>() == false) {
+				scatter_<I, I>(*result);
+			}
+			finished(plan_.group_size[I]);
 		};
 	}
 
@@ -117,13 +226,115 @@ public:
 		}
 	}
 
+	/// Get the request ID of the first command, the others follow it.
+	std::uint8_t requestId() const {
+		return first_request_id_;
+	}
+
 protected:
+	/// Mark a number of commands as finished.
+	void finished(int count) {
+		if ((finished_commands_ += count) == Count) resolve(Error{});
+	}
+
+	template<std::size_t... I>
+	static Plan makePlan_(Commands const & commands, std::index_sequence<I...>) {
+		constexpr std::array<bool, Count> coalescable{{is_coalescable<command_t<I>>...}};
+		constexpr std::array<std::size_t, Count> max_count{{coalesce_traits<command_t<I>>::max_count...}};
+		constexpr std::array<bool, Count> even_count{{coalesce_traits<command_t<I>>::even_count...}};
+		constexpr std::array<bool, Count> same_as_previous{{(I > 0 && std::is_same<command_t<I>, command_t<(I > 0 ? I - 1 : 0)>>::value)...}};
+		std::array<int, Count> index{{coalesce_traits<command_t<I>>::index(std::get<I>(commands))...}};
+
+		Plan plan{};
+		std::size_t head = 0;
+		for (std::size_t i = 0; i < std::size_t(Count); ++i) {
+			bool extend = coalescable[i]
+				&& same_as_previous[i]
+				&& plan.group_size[head] > 0
+				&& head + plan.group_size[head] == i
+				&& index[i] == index[i - 1] + 1
+				&& plan.group_size[head] < max_count[i];
+
+			if (extend) {
+				++plan.group_size[head];
+				plan.group_size[i] = 0;
+				continue;
+			}
+
+			// Split off the last command of an odd group if the group size must be even.
+			if (i > 0 && even_count[head] && plan.group_size[head] > 1 && plan.group_size[head] % 2) {
+				--plan.group_size[head];
+				plan.group_size[i - 1] = 1;
+				++plan.requests;
+			}
+
+			head = i;
+			plan.group_size[i] = 1;
+			++plan.requests;
+		}
+
+		if (Count > 0 && even_count[head] && plan.group_size[head] > 1 && plan.group_size[head] % 2) {
+			--plan.group_size[head];
+			plan.group_size[Count - 1] = 1;
+			++plan.requests;
+		}
+
+		return plan;
+	}
+
+	/// Build the coalesced command for the group starting at I.
+	template<std::size_t I>
+	auto groupCommand(Commands & commands) {
+		using Command = command_t<I>;
+		using Group   = typename coalesce_traits<Command>::type;
+		std::uint8_t count = plan_.group_size[I];
+
+		if constexpr (std::is_same<typename Command::Response, void>::value) {
+			Group result{std::get<I>(commands).index, {}};
+			result.values.reserve(count);
+			gather_<I, I>(commands, result.values);
+			return result;
+		} else {
+			return Group{std::get<I>(commands).index, count};
+		}
+	}
+
+	/// Recursively gather the values of the write commands in the group starting at I.
+	template<std::size_t I, std::size_t J, typename Value>
+	void gather_(Commands & commands, std::vector<Value> & values) {
+		if constexpr (J < Count) {
+			if constexpr (std::is_same<command_t<J>, command_t<I>>::value) {
+				if (J >= I + plan_.group_size[I]) return;
+				values.push_back(std::move(std::get<J>(commands).value));
+				gather_<I, J + 1>(commands, values);
+			}
+		}
+	}
+
+	/// Recursively scatter the values read by the group starting at I into the result tuple.
+	template<std::size_t I, std::size_t J, typename Value>
+	void scatter_(std::vector<Value> & values) {
+		if constexpr (J < Count) {
+			if constexpr (std::is_same<command_t<J>, command_t<I>>::value) {
+				if (J >= I + plan_.group_size[I]) return;
+				std::get<J>(result_) = std::move(values[J - I]);
+				scatter_<I, J + 1>(values);
+			}
+		}
+	}
+
 	/// Recursively initialize sub-sessions.
 	template<std::size_t I>
-	void init_sessions_(Client & client, Commands && commands) {
+	void init_sessions_(Client & client, std::uint8_t request_id, Commands && commands) {
 		if constexpr(I < Count) {
-			std::get<I>(sessions_).emplace(client, std::move(std::get<I>(commands)));
-			init_sessions_<I + 1>(client, std::move(commands));
+			auto & session = std::get<I>(sessions_);
+			if constexpr (is_coalescable<command_t<I>>) {
+				if (plan_.group_size[I] == 1) session.single.emplace(client, request_id++, std::move(std::get<I>(commands)));
+				if (plan_.group_size[I] >  1) session.group.emplace(client, request_id++, groupCommand<I>(commands));
+			} else {
+				session.emplace(client, request_id++, std::move(std::get<I>(commands)));
+			}
+			init_sessions_<I + 1>(client, request_id, std::move(commands));
 		}
 	}
 
@@ -131,16 +342,28 @@ protected:
 	template<std::size_t I>
 	void start_sessions_() {
 		if constexpr(I < Count) {
-			std::get<I>(sessions_)->start(callback<I>());
+			auto & session = std::get<I>(sessions_);
+			if constexpr (is_coalescable<command_t<I>>) {
+				if (session.single) session.single->start(callback<I>());
+				if (session.group)  session.group->start(groupCallback<I>());
+			} else {
+				session->start(callback<I>());
+			}
 			start_sessions_<I + 1>();
 		}
 	}
 
-	/// Recursively start sub-sessions.
+	/// Recursively stop sub-sessions.
 	template<std::size_t I>
 	void stop_sessions_(Error const & error) {
 		if constexpr(I < Count) {
-			std::get<I>(sessions_)->resolve(error);
+			auto & session = std::get<I>(sessions_);
+			if constexpr (is_coalescable<command_t<I>>) {
+				if (session.single) session.single->resolve(error);
+				if (session.group)  session.group->resolve(error);
+			} else {
+				session->resolve(error);
+			}
 			stop_sessions_<I + 1>(error);
 		}
 	}
@@ -153,26 +376,20 @@ auto sendMultipleCommands(
 	std::chrono::steady_clock::time_point deadline,
 	std::function<void(typename MultiCommandSession<Commands>::result_type)> callback
 ) {
-	using Session = DeadlineSession<MultiCommandSession<Commands>>;
-	auto session = std::make_shared<Session>(client.get_executor(), client, std::move(commands));
-	session->start(deadline, [&client, session, callback = std::move(callback)] (typename Session::result_type && result) mutable {
-		session->cancelTimeout();
-		std::move(callback)(std::move(result));
-
-		// Move the shared_ptr into a posted handler which resets it.
-		// That way, any queued event handlers can still completer succesfully.
-		asio::post(client.get_executor(), [session = std::move(session)] () mutable {
-			session.reset();
+	using Session  = MultiCommandSession<Commands>;
+	using Callback = std::function<void(typename Session::result_type)>;
+
+	// Coalesce commands where possible and reserve a range of request IDs for all requests at once.
+	typename Session::Plan plan = Session::plan(commands);
+	Result<std::uint8_t> first_request_id = client.allocateIds(plan.requests);
+	if (!first_request_id) {
+		asio::post(client.get_executor(), [callback = std::move(callback), error = std::move(first_request_id.error_unchecked())] () mutable {
+			std::move(callback)(std::move(error));
 		});
+		return std::shared_ptr<PooledSession<Session, Callback>>{};
+	}
 
-		// Reset our own shared_ptr.
-		// Not really needed since we've moved out of it,
-		// but if the lambda is made non-mutable std::move silently doesn't move,
-		// and then we have a memory leak.
-		// This will make the compiler bark in that case.
-		session.reset();
-	});
-	return session;
+	return startPooledSession<Session>(client, deadline, std::move(callback), *first_request_id, plan, std::move(commands));
 }
 
 }}}}
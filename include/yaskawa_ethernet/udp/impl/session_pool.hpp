@@ -0,0 +1,195 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "../message.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+namespace impl {
+
+/// Memory pool for command sessions and their encode buffers.
+/**
+ * Memory blocks are kept in free lists per size class when they are released,
+ * so that a steady stream of sessions does not need to allocate memory.
+ *
+ * The pool is thread-safe.
+ * Even though a client runs all handlers on its strand,
+ * asio may free the memory of a completed operation on any thread running the io_context.
+ */
+class SessionPool {
+	/// Granularity of the size classes in bytes.
+	static constexpr std::size_t block_granularity = 64;
+
+	/// Number of size classes, larger blocks bypass the pool.
+	static constexpr std::size_t size_classes = 32;
+
+	/// A free memory block.
+	struct FreeBlock {
+		FreeBlock * next;
+	};
+
+	/// Mutex protecting the free lists.
+	std::mutex mutex_;
+
+	/// Free lists indexed by size class.
+	std::array<FreeBlock *, size_classes> free_blocks_{};
+
+	/// Free encode buffers.
+	std::vector<std::vector<std::uint8_t>> free_buffers_;
+
+public:
+	SessionPool() = default;
+	SessionPool(SessionPool const &) = delete;
+	SessionPool & operator=(SessionPool const &) = delete;
+
+	~SessionPool() {
+		for (FreeBlock * & list : free_blocks_) {
+			while (list) ::operator delete(std::exchange(list, list->next));
+		}
+	}
+
+	/// Allocate a block of memory.
+	void * allocate(std::size_t size) {
+		std::size_t size_class = sizeClass(size);
+		if (size_class >= size_classes) return ::operator new(size);
+		std::lock_guard<std::mutex> lock{mutex_};
+		if (FreeBlock * block = free_blocks_[size_class]) {
+			free_blocks_[size_class] = block->next;
+			return block;
+		}
+		return ::operator new((size_class + 1) * block_granularity);
+	}
+
+	/// Return a block of memory to the pool.
+	void deallocate(void * pointer, std::size_t size) noexcept {
+		std::size_t size_class = sizeClass(size);
+		if (size_class >= size_classes) return ::operator delete(pointer);
+		std::lock_guard<std::mutex> lock{mutex_};
+		free_blocks_[size_class] = new (pointer) FreeBlock{free_blocks_[size_class]};
+	}
+
+	/// Get an empty encode buffer with room for a full message.
+	std::vector<std::uint8_t> acquireBuffer() {
+		std::unique_lock<std::mutex> lock{mutex_};
+		if (free_buffers_.empty()) {
+			lock.unlock();
+			std::vector<std::uint8_t> buffer;
+			buffer.reserve(header_size + max_payload_size);
+			return buffer;
+		}
+		std::vector<std::uint8_t> buffer = std::move(free_buffers_.back());
+		free_buffers_.pop_back();
+		return buffer;
+	}
+
+	/// Return an encode buffer to the pool.
+	void releaseBuffer(std::vector<std::uint8_t> && buffer) {
+		if (buffer.capacity() == 0) return;
+		buffer.clear();
+		std::lock_guard<std::mutex> lock{mutex_};
+		free_buffers_.push_back(std::move(buffer));
+	}
+
+private:
+	static std::size_t sizeClass(std::size_t size) {
+		return size == 0 ? 0 : (size - 1) / block_granularity;
+	}
+};
+
+/// Allocator that takes memory from a SessionPool.
+template<typename T>
+class PoolAllocator {
+	template<typename> friend class PoolAllocator;
+
+	/// The pool to allocate from, kept alive by all allocators using it.
+	std::shared_ptr<SessionPool> pool_;
+
+public:
+	using value_type = T;
+
+	explicit PoolAllocator(std::shared_ptr<SessionPool> pool) : pool_{std::move(pool)} {}
+
+	template<typename U>
+	PoolAllocator(PoolAllocator<U> const & other) : pool_{other.pool_} {}
+
+	T * allocate(std::size_t n) {
+		return static_cast<T *>(pool_->allocate(n * sizeof(T)));
+	}
+
+	void deallocate(T * pointer, std::size_t n) noexcept {
+		pool_->deallocate(pointer, n * sizeof(T));
+	}
+
+	template<typename U>
+	bool operator==(PoolAllocator<U> const & other) const { return pool_ == other.pool_; }
+
+	template<typename U>
+	bool operator!=(PoolAllocator<U> const & other) const { return pool_ != other.pool_; }
+};
+
+/// Completion handler wrapper that makes asio allocate operation state from a SessionPool.
+template<typename Handler>
+class PoolHandler {
+	Handler handler_;
+	PoolAllocator<void> allocator_;
+
+public:
+	using allocator_type = PoolAllocator<void>;
+
+	PoolHandler(std::shared_ptr<SessionPool> pool, Handler handler) :
+		handler_{std::move(handler)},
+		allocator_{std::move(pool)} {}
+
+	allocator_type get_allocator() const noexcept {
+		return allocator_;
+	}
+
+	template<typename... Args>
+	void operator()(Args && ... args) {
+		handler_(std::forward<Args>(args)...);
+	}
+};
+
+/// Wrap a completion handler to allocate asio operation state from a SessionPool.
+template<typename Handler>
+PoolHandler<std::decay_t<Handler>> poolHandler(std::shared_ptr<SessionPool> pool, Handler && handler) {
+	return {std::move(pool), std::forward<Handler>(handler)};
+}
+
+}}}}
@@ -27,6 +27,7 @@
  */
 
 #pragma once
+#include <cstddef>
 #include <cstdint>
 
 namespace dr {
@@ -109,6 +110,19 @@ struct Header {
 constexpr std::size_t header_size      = 0x20;
 constexpr std::size_t max_payload_size = 0x1df;
 
+/// Byte offsets of the request specific fields in an encoded header.
+namespace header_offset {
+	constexpr std::size_t payload_size = 6;
+	constexpr std::size_t division     = 9;
+	constexpr std::size_t ack          = 10;
+	constexpr std::size_t request_id   = 11;
+	constexpr std::size_t block_number = 12;
+	constexpr std::size_t command      = 24;
+	constexpr std::size_t instance     = 26;
+	constexpr std::size_t attribute    = 28;
+	constexpr std::size_t service      = 29;
+}
+
 struct RequestHeader : Header {
 	std::uint16_t command;
 	std::uint16_t instance;
@@ -0,0 +1,100 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "../commands.hpp"
+#include "command_traits.hpp"
+#include "message.hpp"
+#include "protocol.hpp"
+
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+/// A command that is encoded once and can be sent many times.
+/**
+ * Sending a prepared command copies the encoded message into a pooled buffer and patches the request ID,
+ * so the command is not encoded again and no memory is allocated.
+ *
+ * A prepared WriteVar<T> command can change its value by patching the value bytes of the message.
+ * Other changes are made with update(), which encodes the command again into the existing buffer.
+ *
+ * Multi-part file commands can not be prepared.
+ */
+template<typename Command>
+class PreparedCommand {
+	static_assert(!is_file_command<Command>::value, "file commands can not be prepared");
+
+	/// The command.
+	Command command_;
+
+	/// The encoded command, with request ID 0.
+	std::vector<std::uint8_t> message_;
+
+public:
+	explicit PreparedCommand(Command command) :
+		command_{std::move(command)}
+	{
+		encode(message_, 0, command_);
+	}
+
+	/// Get the command.
+	Command const & command() const { return command_; }
+
+	/// Get the encoded message, with request ID 0.
+	std::vector<std::uint8_t> const & message() const { return message_; }
+
+	/// Replace the command and encode it again.
+	void update(Command command) {
+		command_ = std::move(command);
+		message_.clear();
+		encode(message_, 0, command_);
+	}
+
+	/// Change the value of a WriteVar<T> command by patching the encoded value.
+	template<typename T>
+	void setValue(T const & value) {
+		static_assert(std::is_same<Command, WriteVar<T>>::value, "setValue() is only available for WriteVar<T> commands");
+		command_.value = value;
+		encodeValue(message_.data() + header_size, value);
+	}
+
+	/// Append the message to a buffer with a request ID patched in.
+	void encodeInto(std::vector<std::uint8_t> & output, std::uint8_t request_id) const {
+		std::size_t offset = output.size();
+		output.insert(output.end(), message_.begin(), message_.end());
+		output[offset + header_offset::request_id] = request_id;
+	}
+};
+
+}}}
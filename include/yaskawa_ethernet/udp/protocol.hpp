@@ -52,12 +52,15 @@ Result<TYPE::Response> decode(ResponseHeader const & header, std::string_view &
 void encode(std::vector<std::uint8_t> & output, std::uint8_t request_id, TYPE const & command); \
 Result<TYPE::Response> decode(ResponseHeader const & header, std::string && data, TYPE const & command)
 
-// Declare ReadVar<TYPE>, ReadVars<TYPE>, WriteVar<TYPE> and WriteVars<TYPE> commands.
+// Declare ReadVar<TYPE>, ReadVars<TYPE>, ReadVarsInto<TYPE>, WriteVar<TYPE> and WriteVars<TYPE> commands,
+// and a function to encode a single value as it appears in the payload of WriteVar<TYPE>.
 #define DECLARE_VAR(TYPE) \
 DECLARE_COMMAND(ReadVar<TYPE>); \
 DECLARE_COMMAND(ReadVars<TYPE>); \
+DECLARE_COMMAND(ReadVarsInto<TYPE>); \
 DECLARE_COMMAND(WriteVar<TYPE>); \
-DECLARE_COMMAND(WriteVars<TYPE>)
+DECLARE_COMMAND(WriteVars<TYPE>); \
+void encodeValue(std::uint8_t * output, TYPE const & value)
 
 DECLARE_COMMAND(ReadStatus);
 DECLARE_COMMAND(ReadCurrentPosition);
@@ -71,7 +74,9 @@ DECLARE_VAR(Position);
 
 DECLARE_FILE_READ_COMMAND(ReadFileList);
 DECLARE_FILE_READ_COMMAND(ReadFile);
+void encode(std::vector<std::uint8_t> & output, std::uint8_t request_id, ReadFileStreaming const & command);
 DECLARE_COMMAND(WriteFile);
+void encode(std::vector<std::uint8_t> & output, std::uint8_t request_id, WriteFileView const & command);
 DECLARE_COMMAND(DeleteFile);
 
 #undef DECLARE_COMMAND
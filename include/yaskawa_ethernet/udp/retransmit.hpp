@@ -0,0 +1,118 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include <algorithm>
+#include <chrono>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+/// Settings for retransmitting unanswered messages.
+struct RetransmitOptions {
+	/// Maximum number of times a message is retransmitted before giving up.
+	unsigned int max_retries = 5;
+
+	/// Retransmission timeout to use before a round trip time has been measured.
+	std::chrono::milliseconds initial_timeout{200};
+
+	/// Lower bound for the retransmission timeout.
+	std::chrono::milliseconds min_timeout{10};
+
+	/// Upper bound for the retransmission timeout, also after backing off.
+	std::chrono::milliseconds max_timeout{2000};
+};
+
+namespace impl {
+
+/// Round trip time estimator to compute retransmission timeouts.
+/**
+ * Uses the Jacobson/Karels algorithm as specified in RFC 6298:
+ * the timeout is the smoothed round trip time plus four times its mean deviation.
+ *
+ * The caller is responsible for only feeding samples of messages that were not retransmitted (Karn's algorithm),
+ * since the reply to a retransmitted message can not be matched to a specific transmission.
+ */
+class RttEstimator {
+public:
+	using Duration = std::chrono::steady_clock::duration;
+
+private:
+	RetransmitOptions options_;
+
+	/// Smoothed round trip time.
+	Duration srtt_{0};
+
+	/// Mean deviation of the round trip time.
+	Duration rttvar_{0};
+
+	/// Current retransmission timeout.
+	Duration rto_;
+
+	/// True once the first sample has been processed.
+	bool has_sample_ = false;
+
+public:
+	explicit RttEstimator(RetransmitOptions const & options = {}) :
+		options_{options},
+		rto_{options.initial_timeout} {}
+
+	/// Get the retransmit options.
+	RetransmitOptions const & options() const { return options_; }
+
+	/// Process a round trip time measurement.
+	void sample(Duration rtt) {
+		if (!has_sample_) {
+			srtt_       = rtt;
+			rttvar_     = rtt / 2;
+			has_sample_ = true;
+		} else {
+			Duration deviation = srtt_ > rtt ? srtt_ - rtt : rtt - srtt_;
+			rttvar_ = (3 * rttvar_ + deviation) / 4;
+			srtt_   = (7 * srtt_ + rtt) / 8;
+		}
+		rto_ = std::clamp<Duration>(srtt_ + 4 * rttvar_, options_.min_timeout, options_.max_timeout);
+	}
+
+	/// Double the retransmission timeout after a timeout expired.
+	void backoff() {
+		rto_ = std::min<Duration>(2 * rto_, options_.max_timeout);
+	}
+
+	/// Get the current retransmission timeout.
+	Duration timeout() const { return rto_; }
+
+	/// Get the smoothed round trip time, or zero if no sample has been processed yet.
+	Duration smoothedRtt() const { return srtt_; }
+
+	/// Get the mean deviation of the round trip time, or zero if no sample has been processed yet.
+	Duration rttVariance() const { return rttvar_; }
+};
+
+}}}}
@@ -0,0 +1,140 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "message.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+/// Histogram of latencies with power-of-two microsecond buckets.
+struct LatencyHistogram {
+	/// The number of buckets.
+	/**
+	 * Bucket 0 holds latencies below 1 microsecond,
+	 * bucket i holds latencies in the range [2^(i-1), 2^i) microseconds.
+	 * The last bucket also holds all larger latencies.
+	 */
+	static constexpr std::size_t bucket_count = 24;
+
+	/// The number of samples in each bucket.
+	std::array<std::uint64_t, bucket_count> buckets{};
+
+	/// The total number of samples.
+	std::uint64_t count = 0;
+
+	/// The sum of all samples.
+	std::chrono::nanoseconds total{0};
+
+	/// The largest sample.
+	std::chrono::nanoseconds max{0};
+
+	/// Add a sample.
+	void add(std::chrono::nanoseconds latency) {
+		std::uint64_t microseconds = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+		std::size_t bucket = 0;
+		while (bucket + 1 < bucket_count && (std::uint64_t(1) << bucket) <= microseconds) ++bucket;
+		++buckets[bucket];
+		++count;
+		total += latency;
+		if (latency > max) max = latency;
+	}
+
+	/// Get the mean latency, or zero if there are no samples.
+	std::chrono::nanoseconds mean() const {
+		return count ? total / std::int64_t(count) : std::chrono::nanoseconds{0};
+	}
+
+	/// Get an upper bound for a quantile of the latency.
+	/**
+	 * \return The upper bound of the bucket that holds the quantile, or the max latency for the last bucket.
+	 */
+	std::chrono::nanoseconds quantile(double q) const {
+		std::uint64_t seen = 0;
+		for (std::size_t i = 0; i + 1 < bucket_count; ++i) {
+			seen += buckets[i];
+			if (seen > 0 && seen >= q * count) return std::min<std::chrono::nanoseconds>(std::chrono::microseconds{std::int64_t(1) << i}, max);
+		}
+		return max;
+	}
+};
+
+/// Identifies the type of a command for statistics.
+struct CommandKey {
+	Division division;
+
+	/// The command number for the robot division, or the service for the file division.
+	std::uint16_t command;
+
+	bool operator==(CommandKey const & other) const { return division == other.division && command == other.command; }
+	bool operator!=(CommandKey const & other) const { return !(*this == other); }
+};
+
+/// Snapshot of the statistics of a client.
+struct ClientStatistics {
+	/// Smoothed round trip time (Jacobson/Karels), or zero if nothing was measured yet.
+	std::chrono::nanoseconds smoothed_rtt{0};
+
+	/// Mean deviation of the round trip time.
+	std::chrono::nanoseconds rtt_variance{0};
+
+	/// The number of messages queued for sending.
+	std::uint64_t messages_sent = 0;
+
+	/// The number of messages received.
+	std::uint64_t messages_received = 0;
+
+	/// The number of messages sent again before the previous transmission was answered.
+	std::uint64_t retransmissions = 0;
+
+	/// The number of commands that failed because their deadline expired.
+	std::uint64_t timeouts = 0;
+
+	/// The number of received messages with an invalid header.
+	std::uint64_t malformed_responses = 0;
+
+	/// The number of responses for a request ID without a handler, like late replies.
+	std::uint64_t unexpected_responses = 0;
+
+	/// Latency between sending a message and receiving its response, for all commands.
+	LatencyHistogram latency;
+
+	/// Latency per command type.
+	std::vector<std::pair<CommandKey, LatencyHistogram>> command_latency;
+};
+
+}}}
@@ -0,0 +1,239 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "../commands.hpp"
+#include "../types.hpp"
+#include "client.hpp"
+#include "executor.hpp"
+#include "message.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+/// A range of variables of one type.
+struct VariableRange {
+	/// The index of the first variable.
+	std::uint8_t index = 0;
+
+	/// The number of variables, zero to not read any.
+	std::size_t count = 0;
+};
+
+/// The data to poll with a Subscription.
+struct SubscriptionOptions {
+	/// Time between the start of two poll cycles.
+	std::chrono::steady_clock::duration period = std::chrono::milliseconds(10);
+
+	/// If true, read the robot status.
+	bool status = false;
+
+	/// If set, read the current position of a control group.
+	std::optional<ReadCurrentPosition> position;
+
+	VariableRange uint8_vars;    ///< B variables to read.
+	VariableRange int16_vars;    ///< I variables to read.
+	VariableRange int32_vars;    ///< D variables to read.
+	VariableRange float_vars;    ///< R variables to read.
+	VariableRange position_vars; ///< P variables to read.
+};
+
+/// The values read by one poll cycle of a Subscription.
+struct SubscriptionSnapshot {
+	/// The poll cycle that read the values.
+	std::uint64_t cycle = 0;
+
+	/// The time the poll cycle started.
+	std::chrono::steady_clock::time_point time;
+
+	Status status{};
+	Position position;
+
+	std::vector<std::uint8_t> uint8_vars;
+	std::vector<std::int16_t> int16_vars;
+	std::vector<std::int32_t> int32_vars;
+	std::vector<float>        float_vars;
+	std::vector<Position>     position_vars;
+
+	/// Check if two snapshots hold the same values, ignoring the cycle and time.
+	bool sameValues(SubscriptionSnapshot const & other) const;
+};
+
+/// Polls a fixed set of data from the controller at a fixed period.
+/**
+ * The request messages are encoded once, with request IDs that stay allocated while the subscription runs.
+ * Each poll cycle only queues the same messages again, so it doesn't encode or allocate anything.
+ * Cycles are scheduled on absolute time points, so the sampling period does not drift with processing time.
+ *
+ * Responses are decoded into a back buffer.
+ * When all responses of a cycle arrived and the values differ from the last published snapshot,
+ * the buffers are swapped and `on_change` is invoked with the new snapshot.
+ *
+ * If a cycle is not complete when the next one starts, it is counted as missed and `on_error` is invoked.
+ * A late response for a missed cycle is accepted as part of the next cycle.
+ *
+ * All callbacks are invoked on the strand of the client.
+ * start() and stop() may be called from any thread.
+ * The subscription must be stopped before it is destroyed, and it must be destroyed from the strand of the client
+ * or while the io_service is not running.
+ */
+class Subscription {
+public:
+	/// Called with the new snapshot when the polled values changed.
+	/**
+	 * The snapshot remains valid until the next call, and can be read from the strand of the client in the meantime.
+	 */
+	std::function<void(SubscriptionSnapshot const & snapshot)> on_change;
+
+	/// Called when a poll cycle failed or missed its deadline.
+	std::function<void(Error error)> on_error;
+
+private:
+	/// A pre-encoded request message.
+	struct Packet {
+		/// Encode the request with a request ID.
+		std::function<void(std::vector<std::uint8_t> & output, std::uint8_t request_id)> encode;
+
+		/// The encoded request.
+		std::vector<std::uint8_t> message;
+
+		/// Decode the response into a snapshot.
+		std::function<Error(ResponseHeader const & header, std::string_view data, SubscriptionSnapshot & snapshot)> decode;
+
+		/// True if the response for the current cycle has been received.
+		bool received = false;
+	};
+
+	Client * client_;
+	SubscriptionOptions options_;
+	SteadyTimer timer_;
+
+	/// The request messages, in order of request ID.
+	std::vector<Packet> packets_;
+
+	/// The request ID of the first packet.
+	std::uint8_t first_id_ = 0;
+
+	/// The published snapshot and the back buffer that responses are decoded into.
+	std::array<SubscriptionSnapshot, 2> buffers_;
+
+	/// The index of the published snapshot in `buffers_`.
+	std::size_t front_ = 0;
+
+	/// True once a snapshot has been published.
+	bool published_ = false;
+
+	/// True while the subscription is running.
+	bool running_ = false;
+
+	/// The number of responses still missing for the current cycle.
+	std::size_t pending_ = 0;
+
+	/// True if a response of the current cycle reported an error.
+	bool cycle_failed_ = false;
+
+	/// The start time of the next cycle.
+	std::chrono::steady_clock::time_point next_cycle_;
+
+	/// The number of started cycles.
+	std::uint64_t cycles_ = 0;
+
+	/// The number of cycles that did not complete before the next one started.
+	std::uint64_t missed_cycles_ = 0;
+
+public:
+	/// Create a subscription.
+	/**
+	 * \throw std::logic_error if nothing is selected to read, or if a variable range does not fit in the variable index space.
+	 */
+	Subscription(Client & client, SubscriptionOptions options);
+
+	Subscription(Subscription const &) = delete;
+	Subscription & operator=(Subscription const &) = delete;
+
+	~Subscription();
+
+	/// Start polling.
+	/**
+	 * If the request IDs can not be allocated, `on_error` is invoked and the subscription is not started.
+	 */
+	void start();
+
+	/// Stop polling and release the request IDs.
+	void stop();
+
+	/// Get the options of the subscription.
+	SubscriptionOptions const & options() const { return options_; }
+
+	/// Get the last published snapshot.
+	/**
+	 * Only valid after `on_change` has been invoked, and only to be used from the strand of the client.
+	 */
+	SubscriptionSnapshot const & snapshot() const { return buffers_[front_]; }
+
+	/// Get the number of started poll cycles.
+	std::uint64_t cycles() const { return cycles_; }
+
+	/// Get the number of poll cycles that did not complete before the next one started.
+	std::uint64_t missedCycles() const { return missed_cycles_; }
+
+private:
+	/// Add a request for each chunk of a variable range that fits in one message.
+	template<typename T>
+	void addVariables(VariableRange range, std::vector<T> SubscriptionSnapshot::* values);
+
+	/// Allocate the request IDs, encode the requests and start the first cycle.
+	void startNow();
+
+	/// Remove the response handlers and release the request IDs.
+	void stopNow();
+
+	/// Wait for the next cycle.
+	void scheduleCycle();
+
+	/// Send all requests of a cycle.
+	void startCycle();
+
+	/// Called when a response arrives.
+	void onResponse(std::size_t packet, ResponseHeader const & header, std::string_view data);
+
+	/// Publish the back buffer if the values changed.
+	void finishCycle();
+};
+
+}}}
@@ -0,0 +1,148 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "statistics.hpp"
+#include "yaskawa_ethernet/config.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+/// True if the tracing hooks of the client are compiled in.
+/**
+ * Tracing is enabled with the ENABLE_TRACING CMake option,
+ * which defines YASKAWA_ETHERNET_TRACING in the generated yaskawa_ethernet/config.hpp.
+ * When disabled, the hooks compile to nothing and no timestamps are taken for them.
+ */
+#ifdef YASKAWA_ETHERNET_TRACING
+constexpr bool trace_enabled = true;
+#else
+constexpr bool trace_enabled = false;
+#endif
+
+/// Events recorded by the tracing hooks.
+enum class TraceEvent : std::uint8_t {
+	send,     ///< A message was queued for sending.
+	receive,  ///< A message with a valid header was received.
+	dispatch, ///< The handler for a response ran, spans the handler.
+	decode,   ///< A response was decoded, spans the decoding.
+	timeout,  ///< The deadline of a command or file transfer expired.
+	resolve,  ///< A command completed, spans the completion callback.
+};
+
+/// Get the name of a trace event.
+char const * toString(TraceEvent event);
+
+/// A single recorded trace event.
+struct TraceRecord {
+	/// The event that happened.
+	TraceEvent event;
+
+	/// The request ID of the message involved.
+	std::uint8_t request_id;
+
+	/// The command of the last message sent with the request ID.
+	CommandKey command;
+
+	/// The start of the event.
+	std::chrono::steady_clock::time_point start;
+
+	/// The end of the event, equal to start for instantaneous events.
+	std::chrono::steady_clock::time_point end;
+};
+
+/// Receiver for trace events of a client.
+/**
+ * The tracer is invoked on the strand of the client, on the hot path, so it should be cheap.
+ */
+class Tracer {
+public:
+	virtual ~Tracer() = default;
+
+	/// Record an event.
+	virtual void record(TraceRecord const & record) = 0;
+};
+
+/// Tracer that keeps the most recent events in a fixed size ring buffer.
+/**
+ * Recording does not allocate.
+ * The recorder must only be accessed from the strand of the client it is attached to.
+ */
+class TraceRecorder : public Tracer {
+	/// Storage for the recorded events.
+	std::vector<TraceRecord> records_;
+
+	/// The index to write the next event to.
+	std::size_t next_ = 0;
+
+	/// The total number of events recorded, including overwritten events.
+	std::uint64_t recorded_ = 0;
+
+public:
+	/// Construct a recorder that keeps the last `capacity` events.
+	explicit TraceRecorder(std::size_t capacity = 65536) : records_(capacity == 0 ? 1 : capacity) {}
+
+	void record(TraceRecord const & record) override {
+		records_[next_] = record;
+		if (++next_ == records_.size()) next_ = 0;
+		++recorded_;
+	}
+
+	/// Get the number of events in the buffer.
+	std::size_t size() const {
+		return recorded_ < records_.size() ? std::size_t(recorded_) : records_.size();
+	}
+
+	/// Get the total number of events recorded, including overwritten events.
+	std::uint64_t recorded() const { return recorded_; }
+
+	/// Get the events in the buffer, oldest first.
+	std::vector<TraceRecord> records() const;
+
+	/// Remove all events.
+	void clear() {
+		next_     = 0;
+		recorded_ = 0;
+	}
+
+	/// Write the events in the buffer as Chrome trace event JSON.
+	/**
+	 * The output can be loaded in chrome://tracing or Perfetto.
+	 * Each request ID is shown as a separate thread, timestamps are relative to the earliest event.
+	 */
+	void writeChromeTrace(std::ostream & out) const;
+};
+
+}}}
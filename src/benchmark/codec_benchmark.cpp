@@ -0,0 +1,303 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../udp/decode.hpp"
+#include "../udp/encode.hpp"
+#include "udp/command_traits.hpp"
+#include "udp/prepared_command.hpp"
+#include "udp/protocol.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+/// Number of heap allocations made by the process so far.
+std::size_t allocations = 0;
+
+/// If false, allocations are not counted, used to exclude benchmark setup.
+bool count_allocations = true;
+
+}
+
+void * operator new(std::size_t size) {
+	if (count_allocations) ++allocations;
+	if (void * result = std::malloc(size ? size : 1)) return result;
+	throw std::bad_alloc{};
+}
+
+void operator delete(void * pointer) noexcept {
+	std::free(pointer);
+}
+
+void operator delete(void * pointer, std::size_t) noexcept {
+	std::free(pointer);
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+namespace {
+
+/// Run a benchmark and report the number of allocations per operation.
+template<typename F>
+void measure(benchmark::State & state, F && operation) {
+	std::size_t start = allocations;
+	for (auto _ : state) operation();
+	state.counters["allocs/op"] = benchmark::Counter(allocations - start, benchmark::Counter::kAvgIterations);
+}
+
+/// Copy data without counting the allocations.
+template<typename T>
+T uncountedCopy(T const & value) {
+	count_allocations = false;
+	T result = value;
+	count_allocations = true;
+	return result;
+}
+
+/// Get a sample value to encode for a variable type.
+template<typename T> T sampleValue();
+template<> std::uint8_t sampleValue() { return 42; }
+template<> std::int16_t sampleValue() { return -1234; }
+template<> std::int32_t sampleValue() { return 123456; }
+template<> float sampleValue() { return 3.25; }
+template<> Position sampleValue() { return CartesianPosition{100.5, -200.25, 300, 180, 0, 90}; }
+
+/// Encode the wire representation of a variable response with `count` values.
+template<typename T>
+std::string encodeValues(std::size_t count) {
+	std::string result(count > 1 ? 4 : 0, '\0');
+	if (count > 1) encode(reinterpret_cast<std::uint8_t *>(result.data()), std::int32_t(count));
+	for (std::size_t i = 0; i < count; ++i) {
+		std::size_t offset = result.size();
+		result.resize(offset + encoded_size<T>::value);
+		encode(reinterpret_cast<std::uint8_t *>(&result[offset]), sampleValue<T>());
+	}
+	return result;
+}
+
+/// Maximum number of variables of a type in a single message.
+template<typename T>
+constexpr std::size_t max_var_count = std::min<std::size_t>(255, (max_payload_size - 4) / encoded_size<T>::value);
+
+/// Benchmark encoding a command into a reused buffer.
+template<typename Command>
+void encodeCommand(benchmark::State & state, Command command) {
+	std::vector<std::uint8_t> buffer;
+	buffer.reserve(header_size + max_payload_size);
+	measure(state, [&] () {
+		buffer.clear();
+		encode(buffer, 7, command);
+		benchmark::DoNotOptimize(buffer.data());
+	});
+}
+
+/// Benchmark copying a prepared command into a reused buffer with a new request ID.
+template<typename Command>
+void encodePrepared(benchmark::State & state, Command command) {
+	PreparedCommand<Command> prepared{std::move(command)};
+	std::vector<std::uint8_t> buffer;
+	buffer.reserve(header_size + max_payload_size);
+	std::uint8_t request_id = 0;
+	measure(state, [&] () {
+		buffer.clear();
+		prepared.encodeInto(buffer, ++request_id);
+		benchmark::DoNotOptimize(buffer.data());
+	});
+}
+
+/// Benchmark decoding a response with a given payload.
+template<typename Command>
+void decodeCommand(benchmark::State & state, Command command, std::string payload) {
+	std::string_view sample = payload;
+	if (!decode(ResponseHeader{}, sample, command)) return state.SkipWithError("failed to decode sample response");
+	measure(state, [&] () {
+		std::string_view data = payload;
+		auto result = decode(ResponseHeader{}, data, command);
+		benchmark::DoNotOptimize(result);
+	});
+	if (!payload.empty()) state.SetBytesProcessed(state.iterations() * payload.size());
+}
+
+/// Benchmark decoding a file command response, which takes ownership of the data.
+template<typename Command>
+void decodeFileCommand(benchmark::State & state, Command command, std::string payload) {
+	if (!decode(ResponseHeader{}, std::string{payload}, command)) return state.SkipWithError("failed to decode sample response");
+	measure(state, [&] () {
+		state.PauseTiming();
+		std::string data = uncountedCopy(payload);
+		state.ResumeTiming();
+		auto result = decode(ResponseHeader{}, std::move(data), command);
+		benchmark::DoNotOptimize(result);
+	});
+	if (!payload.empty()) state.SetBytesProcessed(state.iterations() * payload.size());
+}
+
+void benchmarkEncodeRequestHeader(benchmark::State & state) {
+	RequestHeader header;
+	header.payload_size = 4;
+	header.division     = Division::robot;
+	header.ack          = false;
+	header.request_id   = 7;
+	header.block_number = 0;
+	header.command      = commands::robot::readwrite_int32_variable;
+	header.instance     = 12;
+	header.attribute    = 0;
+	header.service      = service::get_single;
+	EncodedHeader buffer;
+	measure(state, [&] () {
+		encode(buffer.data(), header);
+		benchmark::DoNotOptimize(buffer.data());
+	});
+}
+
+void benchmarkDecodeResponseHeader(benchmark::State & state) {
+	ResponseHeader header;
+	header.payload_size = 0;
+	header.division     = Division::robot;
+	header.ack          = true;
+	header.request_id   = 7;
+	header.block_number = 0x80000000;
+	header.service      = service::get_single | 0x80;
+	header.status       = 0;
+	header.extra_status = 0;
+	EncodedHeader buffer;
+	encode(buffer.data(), header);
+	std::string_view sample{reinterpret_cast<char const *>(buffer.data()), buffer.size()};
+	if (!decodeResponseHeader(sample)) return state.SkipWithError("failed to decode sample header");
+	measure(state, [&] () {
+		std::string_view data{reinterpret_cast<char const *>(buffer.data()), buffer.size()};
+		auto result = decodeResponseHeader(data);
+		benchmark::DoNotOptimize(result);
+	});
+}
+
+template<typename T>
+void decodeValue(benchmark::State & state) {
+	std::string payload = encodeValues<T>(1);
+	measure(state, [&] () {
+		std::string_view data = payload;
+		auto result = decode<T>(data);
+		benchmark::DoNotOptimize(result);
+	});
+}
+
+/// Register the benchmarks for all variable commands of one type.
+template<typename T>
+void registerVarBenchmarks(std::string const & type) {
+	std::uint8_t max_count = max_var_count<T>;
+	static std::vector<T> output(max_count);
+	estd::view<T> max_view{output.data(), max_count};
+
+	benchmark::RegisterBenchmark(("decode<" + type + ">").c_str(), decodeValue<T>);
+	benchmark::RegisterBenchmark(("encode/ReadVar<" + type + ">").c_str(), encodeCommand<ReadVar<T>>, ReadVar<T>{3});
+	benchmark::RegisterBenchmark(("decode/ReadVar<" + type + ">").c_str(), decodeCommand<ReadVar<T>>, ReadVar<T>{3}, encodeValues<T>(1));
+	benchmark::RegisterBenchmark(("encode/WriteVar<" + type + ">").c_str(), encodeCommand<WriteVar<T>>, WriteVar<T>{3, sampleValue<T>()});
+	benchmark::RegisterBenchmark(("decode/WriteVar<" + type + ">").c_str(), decodeCommand<WriteVar<T>>, WriteVar<T>{3, sampleValue<T>()}, "");
+	benchmark::RegisterBenchmark(("encode/ReadVarsInto<" + type + ">").c_str(), encodeCommand<ReadVarsInto<T>>, ReadVarsInto<T>{0, max_view});
+
+	for (std::uint8_t count : {std::uint8_t(2), std::uint8_t(8), max_count}) {
+		std::string suffix = ">/" + std::to_string(count);
+		estd::view<T> view{output.data(), count};
+		benchmark::RegisterBenchmark(("encode/ReadVars<" + type + suffix).c_str(), encodeCommand<ReadVars<T>>, ReadVars<T>{0, count});
+		benchmark::RegisterBenchmark(("decode/ReadVars<" + type + suffix).c_str(), decodeCommand<ReadVars<T>>, ReadVars<T>{0, count}, encodeValues<T>(count));
+		benchmark::RegisterBenchmark(("decode/ReadVarsInto<" + type + suffix).c_str(), decodeCommand<ReadVarsInto<T>>, ReadVarsInto<T>{0, view}, encodeValues<T>(count));
+		benchmark::RegisterBenchmark(("encode/WriteVars<" + type + suffix).c_str(), encodeCommand<WriteVars<T>>, WriteVars<T>{0, std::vector<T>(count, sampleValue<T>())});
+		benchmark::RegisterBenchmark(("decode/WriteVars<" + type + suffix).c_str(), decodeCommand<WriteVars<T>>, WriteVars<T>{0, {}}, "");
+	}
+}
+
+/// Create a file list response with a number of names.
+std::string fileList(std::size_t count) {
+	std::string result;
+	for (std::size_t i = 0; i < count; ++i) result += "JOB_" + std::to_string(i) + ".JBI\r\n";
+	return result;
+}
+
+void registerBenchmarks() {
+	static CartesianPosition target{100.5, -200.25, 300, 180, 0, 90};
+
+	benchmark::RegisterBenchmark("encode/RequestHeader", benchmarkEncodeRequestHeader);
+	benchmark::RegisterBenchmark("decode/ResponseHeader", benchmarkDecodeResponseHeader);
+
+	benchmark::RegisterBenchmark("encode/ReadStatus", encodeCommand<ReadStatus>, ReadStatus{});
+	benchmark::RegisterBenchmark("decode/ReadStatus", decodeCommand<ReadStatus>, ReadStatus{}, std::string(8, '\x5a'));
+
+	ReadCurrentPosition read_position{0, CoordinateSystemType::robot_cartesian};
+	benchmark::RegisterBenchmark("encode/ReadCurrentPosition", encodeCommand<ReadCurrentPosition>, read_position);
+	benchmark::RegisterBenchmark("decode/ReadCurrentPosition", decodeCommand<ReadCurrentPosition>, read_position, encodeValues<Position>(1));
+
+	MoveL move{0, target, Speed{SpeedType::translation, 1000}};
+	benchmark::RegisterBenchmark("encode/MoveL", encodeCommand<MoveL>, move);
+	benchmark::RegisterBenchmark("decode/MoveL", decodeCommand<MoveL>, move, "");
+
+	benchmark::RegisterBenchmark("prepared/ReadStatus", encodePrepared<ReadStatus>, ReadStatus{});
+	benchmark::RegisterBenchmark("prepared/ReadVars<int32>/8", encodePrepared<ReadVars<std::int32_t>>, ReadVars<std::int32_t>{0, 8});
+	benchmark::RegisterBenchmark("prepared/WriteVar<Position>", encodePrepared<WriteVar<Position>>, WriteVar<Position>{3, sampleValue<Position>()});
+
+	registerVarBenchmarks<std::uint8_t>("uint8");
+	registerVarBenchmarks<std::int16_t>("int16");
+	registerVarBenchmarks<std::int32_t>("int32");
+	registerVarBenchmarks<float>("float");
+	registerVarBenchmarks<Position>("Position");
+
+	benchmark::RegisterBenchmark("encode/ReadFileList", encodeCommand<ReadFileList>, ReadFileList{"*.JBI"});
+	for (std::size_t count : {10, 1000}) {
+		benchmark::RegisterBenchmark(("decode/ReadFileList/" + std::to_string(count)).c_str(), decodeFileCommand<ReadFileList>, ReadFileList{"*.JBI"}, fileList(count));
+	}
+
+	benchmark::RegisterBenchmark("encode/ReadFile", encodeCommand<ReadFile>, ReadFile{"TEST.JBI"});
+	benchmark::RegisterBenchmark("decode/ReadFile/65536", decodeFileCommand<ReadFile>, ReadFile{"TEST.JBI"}, std::string(65536, 'x'));
+
+	benchmark::RegisterBenchmark("encode/WriteFile", encodeCommand<WriteFile>, WriteFile{"TEST.JBI", std::string(65536, 'x')});
+	benchmark::RegisterBenchmark("decode/WriteFile", decodeCommand<WriteFile>, WriteFile{"TEST.JBI", ""}, "");
+
+	benchmark::RegisterBenchmark("encode/DeleteFile", encodeCommand<DeleteFile>, DeleteFile{"TEST.JBI"});
+	benchmark::RegisterBenchmark("decode/DeleteFile", decodeCommand<DeleteFile>, DeleteFile{"TEST.JBI"}, "");
+}
+
+}
+
+}}}
+
+int main(int argc, char * * argv) {
+	dr::yaskawa::udp::registerBenchmarks();
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
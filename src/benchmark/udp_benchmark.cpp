@@ -0,0 +1,311 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../mock/mock_server.hpp"
+#include "udp/client.hpp"
+
+#include <asio/io_service.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace std::chrono_literals;
+using namespace dr::yaskawa;
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+	std::size_t iterations  = 10000;
+	std::size_t file_size   = 1024 * 1024;
+	std::string output;
+	std::string trace;
+	udp::MockServerOptions mock;
+};
+
+std::chrono::milliseconds timeout = 1s;
+
+/// Time elapsed since a time point in microseconds.
+double microsecondsSince(Clock::time_point start) {
+	return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+/// Run the client until a condition holds.
+void runUntil(asio::io_service & ios, std::function<bool()> condition) {
+	while (!condition() && ios.run_one()) {}
+}
+
+/// Write latency statistics and a histogram with power-of-two microsecond buckets as JSON.
+void writeLatency(std::ostream & out, std::vector<double> samples) {
+	std::sort(samples.begin(), samples.end());
+	auto percentile = [&] (double p) {
+		if (samples.empty()) return 0.0;
+		std::size_t index = std::min(samples.size() - 1, std::size_t(std::ceil(p * samples.size())) - 1);
+		return samples[index];
+	};
+	double mean = samples.empty() ? 0 : std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+
+	out << "{"
+		<< "\"samples\": " << samples.size()
+		<< ", \"min_us\": "  << (samples.empty() ? 0 : samples.front())
+		<< ", \"mean_us\": " << mean
+		<< ", \"p50_us\": "  << percentile(0.5)
+		<< ", \"p99_us\": "  << percentile(0.99)
+		<< ", \"p999_us\": " << percentile(0.999)
+		<< ", \"max_us\": "  << (samples.empty() ? 0 : samples.back())
+		<< ", \"histogram\": [";
+
+	std::size_t index = 0;
+	bool first = true;
+	for (double bound = 1; index < samples.size(); bound *= 2) {
+		std::size_t count = 0;
+		while (index < samples.size() && samples[index] <= bound) {
+			++count;
+			++index;
+		}
+		if (count == 0) continue;
+		out << (first ? "" : ", ") << "{\"le_us\": " << bound << ", \"count\": " << count << "}";
+		first = false;
+	}
+	out << "]}";
+}
+
+/// Measure the round trip time of single commands, one at a time.
+std::vector<double> measureLatency(udp::Client & client, asio::io_service & ios, std::size_t iterations) {
+	std::vector<double> samples;
+	samples.reserve(iterations);
+	for (std::size_t i = 0; i < iterations; ++i) {
+		bool done = false;
+		Clock::time_point start = Clock::now();
+		client.sendCommand(ReadInt32Var{std::uint8_t(i % 100)}, timeout, [&] (Result<std::int32_t> result) {
+			if (result) samples.push_back(microsecondsSince(start));
+			done = true;
+		});
+		runUntil(ios, [&] () { return done; });
+	}
+	return samples;
+}
+
+/// Measure the number of commands per second with a fixed number of commands in flight.
+double measureThroughput(udp::Client & client, asio::io_service & ios, std::size_t depth, std::size_t total) {
+	std::size_t sent = 0;
+	std::size_t done = 0;
+	std::function<void()> send_one = [&] () {
+		++sent;
+		client.sendCommand(ReadInt32Var{std::uint8_t(sent % 100)}, timeout, [&] (Result<std::int32_t>) {
+			++done;
+			if (sent < total) send_one();
+		});
+	};
+
+	Clock::time_point start = Clock::now();
+	for (std::size_t i = 0; i < depth && sent < total; ++i) send_one();
+	runUntil(ios, [&] () { return done == total; });
+	return total / (microsecondsSince(start) / 1e6);
+}
+
+/// Measure the round trip time of a batch of 8 reads, sent as one multi-command or as 8 single commands.
+std::pair<std::vector<double>, std::vector<double>> measureMultiCommand(udp::Client & client, asio::io_service & ios, std::size_t iterations) {
+	std::vector<double> multi;
+	std::vector<double> single;
+
+	for (std::size_t i = 0; i < iterations; ++i) {
+		bool done = false;
+		Clock::time_point start = Clock::now();
+		auto commands = std::make_tuple(
+			ReadInt32Var{0}, ReadInt32Var{1}, ReadInt32Var{2}, ReadInt32Var{3},
+			ReadInt32Var{4}, ReadInt32Var{5}, ReadInt32Var{6}, ReadInt32Var{7}
+		);
+		client.sendCommands(commands, timeout, [&] (auto result) {
+			if (result) multi.push_back(microsecondsSince(start));
+			done = true;
+		});
+		runUntil(ios, [&] () { return done; });
+	}
+
+	for (std::size_t i = 0; i < iterations; ++i) {
+		std::size_t done   = 0;
+		std::size_t failed = 0;
+		Clock::time_point start = Clock::now();
+		for (std::uint8_t index = 0; index < 8; ++index) {
+			client.sendCommand(ReadInt32Var{index}, timeout, [&] (Result<std::int32_t> result) {
+				if (!result) ++failed;
+				++done;
+			});
+		}
+		runUntil(ios, [&] () { return done == 8; });
+		if (!failed) single.push_back(microsecondsSince(start));
+	}
+
+	return {std::move(multi), std::move(single)};
+}
+
+/// Measure upload and download speed in MB/s.
+std::pair<double, double> measureFileTransfer(udp::Client & client, asio::io_service & ios, std::size_t size) {
+	std::string data(size, '\0');
+	for (std::size_t i = 0; i < size; ++i) data[i] = 'a' + i % 26;
+
+	std::optional<Result<void>> uploaded;
+	Clock::time_point start = Clock::now();
+	client.writeFile("BENCHMARK.JBI", data, 600s, [&] (Result<void> result) { uploaded = std::move(result); }, nullptr);
+	runUntil(ios, [&] () { return bool(uploaded); });
+	double upload = *uploaded ? size / microsecondsSince(start) : 0;
+
+	std::optional<Result<std::string>> downloaded;
+	start = Clock::now();
+	client.readFile("BENCHMARK.JBI", 600s, [&] (Result<std::string> result) { downloaded = std::move(result); }, nullptr);
+	runUntil(ios, [&] () { return bool(downloaded); });
+	double download = *downloaded && **downloaded == data ? size / microsecondsSince(start) : 0;
+
+	return {upload, download};
+}
+
+void usage(char const * name) {
+	std::cerr
+		<< "usage: " << name << " [options]\n\n"
+		<< "Benchmark the UDP client against a local mock controller and print the results as JSON.\n\n"
+		<< "options:\n"
+		<< "\t--iterations N   number of commands per measurement (default 10000)\n"
+		<< "\t--file-size N    size of the transferred file in bytes (default 1048576)\n"
+		<< "\t--latency US     delay of each mock response in microseconds\n"
+		<< "\t--jitter US      maximum random extra delay in microseconds\n"
+		<< "\t--loss P         probability to drop a request and a response\n"
+		<< "\t--output PATH    write the results to a file instead of stdout\n"
+		<< "\t--trace PATH     write a Chrome trace of the multi-command measurement (needs ENABLE_TRACING)\n";
+}
+
+}
+
+int main(int argc, char * * argv) {
+	Options options;
+	for (int i = 1; i < argc; ++i) {
+		std::string option = argv[i];
+		if (option == "-h" || option == "--help") {
+			usage(argv[0]);
+			return 0;
+		}
+		if (i + 1 >= argc) {
+			std::cerr << "missing value for option " << option << "\n";
+			return 1;
+		}
+		char const * value = argv[++i];
+		if      (option == "--iterations") options.iterations   = std::atol(value);
+		else if (option == "--file-size")  options.file_size    = std::atol(value);
+		else if (option == "--latency")    options.mock.latency = std::chrono::microseconds{std::atol(value)};
+		else if (option == "--jitter")     options.mock.jitter  = std::chrono::microseconds{std::atol(value)};
+		else if (option == "--loss")       options.mock.request_loss = options.mock.response_loss = std::atof(value);
+		else if (option == "--output")     options.output = value;
+		else if (option == "--trace")      options.trace  = value;
+		else {
+			std::cerr << "unknown option: " << option << "\n";
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	asio::io_service server_ios;
+	udp::MockServer server{server_ios, options.mock};
+	server.start();
+	std::thread server_thread{[&server_ios] () { server_ios.run(); }};
+
+	asio::io_service ios;
+	udp::Client client{ios};
+	std::optional<Error> connected;
+	client.connect("127.0.0.1", server.endpoint().port(), 1s, [&] (Error error) { connected = error; });
+	runUntil(ios, [&] () { return bool(connected); });
+	if (*connected) {
+		std::cerr << "Failed to connect to mock server: " << connected->format() << "\n";
+		server_ios.stop();
+		server_thread.join();
+		return 1;
+	}
+
+	std::ofstream file;
+	if (!options.output.empty()) file.open(options.output);
+	std::ostream & out = options.output.empty() ? std::cout : file;
+
+	out << "{\n";
+	out << "  \"config\": {"
+		<< "\"iterations\": " << options.iterations
+		<< ", \"file_size\": " << options.file_size
+		<< ", \"mock_latency_us\": " << options.mock.latency.count()
+		<< ", \"mock_jitter_us\": " << options.mock.jitter.count()
+		<< ", \"mock_loss\": " << options.mock.request_loss
+		<< "},\n";
+
+	out << "  \"latency\": ";
+	writeLatency(out, measureLatency(client, ios, options.iterations));
+	out << ",\n";
+
+	out << "  \"throughput\": [";
+	bool first = true;
+	for (std::size_t depth : {1, 4, 16, 64}) {
+		out << (first ? "" : ", ") << "{\"depth\": " << depth << ", \"commands_per_second\": " << measureThroughput(client, ios, depth, options.iterations) << "}";
+		first = false;
+	}
+	out << "],\n";
+
+	udp::TraceRecorder recorder;
+	if (!options.trace.empty()) {
+		if (!udp::trace_enabled) std::cerr << "Tracing is not compiled in, rebuild with ENABLE_TRACING to record a trace.\n";
+		client.setTracer(&recorder);
+	}
+	auto [multi, single] = measureMultiCommand(client, ios, options.iterations / 8);
+	client.setTracer(nullptr);
+	ios.poll();
+	if (!options.trace.empty()) {
+		std::ofstream trace_file{options.trace};
+		recorder.writeChromeTrace(trace_file);
+	}
+	out << "  \"multi_command\": {\"commands_per_batch\": 8, \"multi\": ";
+	writeLatency(out, std::move(multi));
+	out << ", \"single\": ";
+	writeLatency(out, std::move(single));
+	out << "},\n";
+
+	auto [upload, download] = measureFileTransfer(client, ios, options.file_size);
+	out << "  \"file_transfer\": {\"bytes\": " << options.file_size << ", \"upload_mb_per_s\": " << upload << ", \"download_mb_per_s\": " << download << "}\n";
+	out << "}\n";
+
+	client.close();
+	server_ios.stop();
+	server_thread.join();
+	return 0;
+}
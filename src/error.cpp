@@ -47,6 +47,7 @@ namespace {
 				case errc::malformed_response:    return "malformed message";
 				case errc::command_failed:        return "command failed";
 				case errc::unknown_request:       return "unknown request";
+				case errc::no_free_request_id:    return "no free request ID";
 			}
 			return "unkown error: " + std::to_string(error);
 		}
@@ -0,0 +1,128 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "types.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dr {
+namespace yaskawa {
+
+/// Read-only view of the contents of a file descriptor.
+/**
+ * Regular files are mapped into memory, so the data is read straight from the page cache.
+ * Other file descriptors (like pipes) can not be mapped and are read into a buffer instead,
+ * which blocks until the end of the data is reached.
+ *
+ * A mapped file must not be truncated while the view exists.
+ */
+class FileContents {
+	/// The memory mapping, or nullptr if the data is buffered.
+	void * mapping_ = nullptr;
+
+	/// The size of the memory mapping.
+	std::size_t mapping_size_ = 0;
+
+	/// The offset of the data in the memory mapping.
+	std::size_t mapping_offset_ = 0;
+
+	/// The buffered data, if the file descriptor could not be mapped.
+	std::string buffer_;
+
+	FileContents() = default;
+
+public:
+	FileContents(FileContents const &) = delete;
+	FileContents & operator=(FileContents const &) = delete;
+
+	~FileContents() {
+		if (mapping_) ::munmap(mapping_, mapping_size_);
+	}
+
+	/// Get the contents of a file descriptor, starting at the current file offset.
+	/**
+	 * The file descriptor is not closed and may be closed as soon as this function returns.
+	 */
+	static Result<std::shared_ptr<FileContents>> open(int fd) {
+		std::shared_ptr<FileContents> result{new FileContents};
+
+		struct ::stat info;
+		if (::fstat(fd, &info) != 0) return systemError("getting file status of file descriptor " + std::to_string(fd));
+
+		// Map the whole file, the data starts at the current offset.
+		off_t offset = S_ISREG(info.st_mode) ? ::lseek(fd, 0, SEEK_CUR) : -1;
+		if (offset >= 0 && offset < info.st_size) {
+			void * mapping = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping != MAP_FAILED) {
+				::madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+				result->mapping_        = mapping;
+				result->mapping_size_   = info.st_size;
+				result->mapping_offset_ = offset;
+				return result;
+			}
+		}
+
+		// Fall back to reading the data.
+		if (S_ISREG(info.st_mode) && offset >= 0 && info.st_size > offset) result->buffer_.reserve(info.st_size - offset);
+		char chunk[65536];
+		while (true) {
+			ssize_t count = ::read(fd, chunk, sizeof(chunk));
+			if (count == 0) break;
+			if (count < 0) {
+				if (errno == EINTR) continue;
+				return systemError("reading from file descriptor " + std::to_string(fd));
+			}
+			result->buffer_.append(chunk, count);
+		}
+		return result;
+	}
+
+	/// Get the data.
+	std::string_view data() const {
+		if (mapping_) return {static_cast<char const *>(mapping_) + mapping_offset_, mapping_size_ - mapping_offset_};
+		return buffer_;
+	}
+
+private:
+	/// Make an error from errno.
+	static Error systemError(std::string description) {
+		return Error{std::error_code{errno, std::generic_category()}, std::move(description)};
+	}
+};
+
+}}
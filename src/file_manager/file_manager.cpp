@@ -27,10 +27,17 @@
  */
 
 #include "udp/client.hpp"
+#include "udp/file_transfer_manager.hpp"
 
+#include <cerrno>
+#include <cstring>
 #include <iostream>
+#include <memory>
 #include <string>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 using namespace std::string_literals;
 using namespace std::chrono_literals;
 
@@ -42,7 +49,9 @@ void usage(char const * name) {
 		<< "commands:\n"
 		<< "\tls [type]\n"
 		<< "\tget name\n"
-		<< "\tput name\n"
+		<< "\tput name [local_file]\n"
+		<< "\tmget name...\n"
+		<< "\tmput local_file...\n"
 		<< "\tdelete name\n";
 }
 
@@ -52,34 +61,92 @@ struct Options {
 	std::vector<std::string> args;
 };
 
-void executeCommand(dr::yaskawa::udp::Client & client, Options const & options) {
+/// Exit when all transfers are done, with a non-zero status if any of them failed.
+void exitWhenIdle(udp::FileTransferManager & transfers, std::shared_ptr<std::size_t> failures) {
+	transfers.on_idle = [failures] () {
+		std::exit(*failures ? 2 : 0);
+	};
+}
+
+/// Download files to the current directory, using multiple sessions at once.
+void downloadFiles(udp::FileTransferManager & transfers, std::vector<std::string> const & names) {
+	auto failures = std::make_shared<std::size_t>(0);
+	exitWhenIdle(transfers, failures);
+	for (std::string const & name : names) {
+		int fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if (fd < 0) {
+			std::cerr << "Failed to open " << name << ": " << std::strerror(errno) << "\n";
+			std::exit(1);
+		}
+		transfers.download(name, fd, [name, fd, failures] (Result<void> result) {
+			::close(fd);
+			if (!result) {
+				std::cerr << "Failed to read file " << name << ": " << result.error().format() << "\n";
+				++*failures;
+			}
+		});
+	}
+}
+
+/// Upload local files, using multiple sessions at once.
+void uploadFiles(udp::FileTransferManager & transfers, std::vector<std::string> const & paths) {
+	auto failures = std::make_shared<std::size_t>(0);
+	exitWhenIdle(transfers, failures);
+	for (std::string const & path : paths) {
+		int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			std::cerr << "Failed to open " << path << ": " << std::strerror(errno) << "\n";
+			std::exit(1);
+		}
+		std::string name = path.substr(path.find_last_of('/') + 1);
+		transfers.upload(name, fd, [name, fd, failures] (Result<void> result) {
+			::close(fd);
+			if (!result) {
+				std::cerr << "Failed to write file " << name << ": " << result.error().format() << "\n";
+				++*failures;
+			}
+		});
+	}
+}
+
+void executeCommand(dr::yaskawa::udp::Client & client, udp::FileTransferManager & transfers, Options const & options) {
 	if (options.command == "ls") {
-		client.readFileList(options.args[0], 100ms, [] (Result<std::vector<std::string>> result) {
+		client.readFileList(options.args[0], 100ms, [] (Result<FileList> result) {
 			if (!result) {
 				std::cerr << "Failed to read file list: " << result.error().format() << "\n";
 				std::exit(2);
 			}
-			for (std::string const & file : *result) {
+			for (std::string_view file : *result) {
 				std::cout << file << "\n";
 			}
 		}, nullptr);
 	} else if (options.command == "get") {
-		client.readFile(options.args[0], 3s, [] (Result<std::string> result) {
+		client.readFileStreaming(options.args[0], STDOUT_FILENO, 3s, [] (Result<void> result) {
 			if (!result) {
 				std::cerr << "Failed to read file: " << result.error().format() << "\n";
 				std::exit(2);
 			}
-			std::cout << *result;
 		}, nullptr);
 	} else if (options.command == "put") {
-		std::stringstream data;
-		data << std::cin.rdbuf();
-		client.writeFile(options.args[0], data.str(), 3s, [] (Result<void> result) {
+		int fd = STDIN_FILENO;
+		if (options.args.size() > 1) {
+			fd = ::open(options.args[1].c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0) {
+				std::cerr << "Failed to open " << options.args[1] << ": " << std::strerror(errno) << "\n";
+				std::exit(1);
+			}
+		}
+		client.writeFile(options.args[0], fd, 3s, [] (Result<void> result) {
 			if (!result) {
 				std::cerr << "Failed to write file: " << result.error().format() << "\n";
 				std::exit(2);
 			}
 		}, nullptr);
+		if (fd != STDIN_FILENO) ::close(fd);
+	} else if (options.command == "mget") {
+		downloadFiles(transfers, options.args);
+	} else if (options.command == "mput") {
+		uploadFiles(transfers, options.args);
 	} else if (options.command == "delete") {
 		client.deleteFile(options.args[0], 3s, [] (Result<void> result) {
 			if (!result) {
@@ -115,11 +182,18 @@ int main(int argc, char * * argv) {
 		}
 		options.args.push_back(argv[3]);
 	} else if (options.command == "put") {
-		if (argc != 4) {
-			std::cerr << "put command takes exactly one argument\n";
+		if (argc != 4 && argc != 5) {
+			std::cerr << "put command takes one or two arguments\n";
 			return 1;
 		}
 		options.args.push_back(argv[3]);
+		if (argc > 4) options.args.push_back(argv[4]);
+	} else if (options.command == "mget" || options.command == "mput") {
+		if (argc < 4) {
+			std::cerr << options.command << " command takes at least one argument\n";
+			return 1;
+		}
+		options.args.assign(argv + 3, argv + argc);
 	} else {
 		std::cerr << "unknown command: " << options.command << "\n";
 	}
@@ -127,13 +201,14 @@ int main(int argc, char * * argv) {
 
 	asio::io_service ios;
 	dr::yaskawa::udp::Client client{ios};
-	client.connect(argv[1], 10040, 100ms, [&client, &options] (Error error) {
+	dr::yaskawa::udp::FileTransferManager transfers{client};
+	client.connect(argv[1], 10040, 100ms, [&client, &transfers, &options] (Error error) {
 		if (error) {
 			std::cerr << "Failed to connect to " << options.host << ":10040: " << error.format() << "\n";
 			std::exit(1);
 		}
 
-		executeCommand(client, options);
+		executeCommand(client, transfers, options);
 	});
 
 	ios.run();
@@ -0,0 +1,517 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "./mock_server.hpp"
+#include "../udp/decode.hpp"
+#include "../udp/encode.hpp"
+
+#include "udp/command_traits.hpp"
+
+#include <asio/post.hpp>
+
+#include <cstring>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+namespace {
+	/// Status codes used by the mock server.
+	namespace status {
+		constexpr std::uint8_t ok                  = 0x00;
+		constexpr std::uint8_t error               = 0x1f;
+		constexpr std::uint8_t undefined_command   = 0x08;
+		constexpr std::uint8_t invalid_instance    = 0x09;
+		constexpr std::uint8_t invalid_data_size   = 0x13;
+	}
+
+	/// Extra status codes used by the mock server.
+	namespace extra_status {
+		constexpr std::uint16_t file_not_found = 0xe2b1;
+	}
+
+	/// Storage information for a variable command.
+	struct VariableInfo {
+		/// The multiple read/write command, used as key for the variable storage.
+		std::uint16_t key;
+
+		/// The encoded size of a single variable.
+		std::size_t size;
+
+		/// True for the multiple read/write command.
+		bool multiple;
+	};
+
+	/// Get the storage information for a variable command.
+	std::optional<VariableInfo> variableInfo(std::uint16_t command) {
+		using namespace commands::robot;
+		switch (command) {
+			case readwrite_int8_variable:           return VariableInfo{readwrite_multiple_int8,            1, false};
+			case readwrite_int16_variable:          return VariableInfo{readwrite_multiple_int16,           2, false};
+			case readwrite_int32_variable:          return VariableInfo{readwrite_multiple_int32,           4, false};
+			case readwrite_float_variable:          return VariableInfo{readwrite_multiple_float,           4, false};
+			case readwrite_robot_position_variable: return VariableInfo{readwrite_multiple_robot_position, 52, false};
+			case readwrite_multiple_int8:           return VariableInfo{readwrite_multiple_int8,            1, true};
+			case readwrite_multiple_int16:          return VariableInfo{readwrite_multiple_int16,           2, true};
+			case readwrite_multiple_int32:          return VariableInfo{readwrite_multiple_int32,           4, true};
+			case readwrite_multiple_float:          return VariableInfo{readwrite_multiple_float,           4, true};
+			case readwrite_multiple_robot_position: return VariableInfo{readwrite_multiple_robot_position, 52, true};
+		}
+		return std::nullopt;
+	}
+
+	/// Encode a status the way the controller sends it.
+	std::array<std::uint8_t, 8> encodeStatus(Status const & status) {
+		std::array<std::uint8_t, 8> result{};
+		result[0] = status.step << 0
+			| status.one_cycle     << 1
+			| status.continuous    << 2
+			| status.running       << 3
+			| status.speed_limited << 4
+			| status.teach         << 5
+			| status.play          << 6
+			| status.remote        << 7;
+		result[4] = status.teach_pendant_hold << 1
+			| status.external_hold << 2
+			| status.command_hold  << 3
+			| status.alarm         << 4
+			| status.error         << 5
+			| status.servo_on      << 6;
+		return result;
+	}
+
+	/// Match a file name against a pattern with `*` wildcards.
+	bool matchPattern(std::string_view pattern, std::string_view name) {
+		std::size_t p = 0;
+		std::size_t n = 0;
+		std::size_t star = std::string_view::npos;
+		std::size_t star_match = 0;
+		while (n < name.size()) {
+			if (p < pattern.size() && pattern[p] == '*') {
+				star = p++;
+				star_match = n;
+			} else if (p < pattern.size() && pattern[p] == name[n]) {
+				++p;
+				++n;
+			} else if (star != std::string_view::npos) {
+				p = star + 1;
+				n = ++star_match;
+			} else {
+				return false;
+			}
+		}
+		while (p < pattern.size() && pattern[p] == '*') ++p;
+		return p == pattern.size();
+	}
+
+	std::string_view asStringView(std::vector<std::uint8_t> const & data) {
+		return {reinterpret_cast<char const *>(data.data()), data.size()};
+	}
+}
+
+MockServer::MockServer(asio::io_service & ios, MockServerOptions options, Endpoint endpoint) :
+	options_{options},
+	socket_{ios, endpoint},
+	send_timer_{ios},
+	random_{options.seed}
+{
+	using namespace commands::robot;
+	for (std::uint16_t command : {readwrite_multiple_int8, readwrite_multiple_int16, readwrite_multiple_int32, readwrite_multiple_float, readwrite_multiple_robot_position}) {
+		variables_[command].resize(256 * variableInfo(command)->size);
+	}
+	position_ = PulsePosition{8};
+}
+
+void MockServer::start() {
+	asio::post(socket_.get_executor(), [this] () {
+		receive();
+	});
+}
+
+void MockServer::stop() {
+	asio::post(socket_.get_executor(), [this] () {
+		std::lock_guard<std::mutex> lock{mutex_};
+		socket_.close();
+		send_timer_.cancel();
+		transfers_.clear();
+	});
+}
+
+MockServer::Statistics MockServer::statistics() const {
+	std::lock_guard<std::mutex> lock{mutex_};
+	return statistics_;
+}
+
+void MockServer::setStatus(Status const & status) {
+	std::lock_guard<std::mutex> lock{mutex_};
+	status_ = encodeStatus(status);
+}
+
+void MockServer::setPosition(Position const & position) {
+	std::lock_guard<std::mutex> lock{mutex_};
+	position_ = position;
+}
+
+template<typename T>
+void MockServer::setVariable(std::uint8_t index, T const & value) {
+	std::lock_guard<std::mutex> lock{mutex_};
+	std::vector<std::uint8_t> & storage = variables_[udp_command<ReadVars<T>>()];
+	encode(storage.data() + index * encoded_size<T>(), value);
+}
+
+template<typename T>
+T MockServer::variable(std::uint8_t index) const {
+	std::lock_guard<std::mutex> lock{mutex_};
+	std::vector<std::uint8_t> const & storage = variables_.at(udp_command<ReadVars<T>>());
+	std::string_view data = asStringView(storage).substr(index * encoded_size<T>(), encoded_size<T>());
+	return *decode<T>(data);
+}
+
+template void MockServer::setVariable<std::uint8_t>(std::uint8_t, std::uint8_t const &);
+template void MockServer::setVariable<std::int16_t>(std::uint8_t, std::int16_t const &);
+template void MockServer::setVariable<std::int32_t>(std::uint8_t, std::int32_t const &);
+template void MockServer::setVariable<float>(std::uint8_t, float const &);
+template void MockServer::setVariable<Position>(std::uint8_t, Position const &);
+
+template std::uint8_t MockServer::variable<std::uint8_t>(std::uint8_t) const;
+template std::int16_t MockServer::variable<std::int16_t>(std::uint8_t) const;
+template std::int32_t MockServer::variable<std::int32_t>(std::uint8_t) const;
+template float        MockServer::variable<float>(std::uint8_t) const;
+template Position     MockServer::variable<Position>(std::uint8_t) const;
+
+void MockServer::setFile(std::string name, std::string data) {
+	std::lock_guard<std::mutex> lock{mutex_};
+	files_[std::move(name)] = std::move(data);
+}
+
+std::optional<std::string> MockServer::file(std::string const & name) const {
+	std::lock_guard<std::mutex> lock{mutex_};
+	auto found = files_.find(name);
+	if (found == files_.end()) return std::nullopt;
+	return found->second;
+}
+
+void MockServer::receive() {
+	socket_.async_receive_from(asio::buffer(read_buffer_), sender_, [this] (std::error_code error, std::size_t size) {
+		onReceive(error, size);
+	});
+}
+
+void MockServer::onReceive(std::error_code error, std::size_t size) {
+	if (error == asio::error::operation_aborted || !socket_.is_open()) return;
+
+	if (!error) {
+		std::lock_guard<std::mutex> lock{mutex_};
+		++statistics_.requests_received;
+		if (chance(options_.request_loss)) {
+			++statistics_.requests_dropped;
+		} else {
+			handleMessage(sender_, {reinterpret_cast<char const *>(read_buffer_.data()), size});
+		}
+	}
+
+	receive();
+}
+
+void MockServer::handleMessage(Endpoint const & client, std::string_view message) {
+	// Malformed requests are ignored, like the controller does.
+	Result<RequestHeader> header = decodeRequestHeader(message);
+	if (!header) return;
+
+	switch (header->division) {
+		case Division::robot: return handleRobotCommand(client, *header, message);
+		case Division::file:  return handleFileCommand(client, *header, message);
+	}
+	respond(client, *header, {}, status::undefined_command);
+}
+
+void MockServer::handleRobotCommand(Endpoint const & client, RequestHeader const & request, std::string_view payload) {
+	switch (request.command) {
+		case commands::robot::read_status_information:
+			return respond(client, request, {reinterpret_cast<char const *>(status_.data()), status_.size()});
+
+		case commands::robot::read_robot_position: {
+			// MoveL is sent with this command number too, with a payload.
+			if (!payload.empty()) return respond(client, request, {});
+			std::array<std::uint8_t, 13 * 4> data;
+			encode(data.data(), position_);
+			return respond(client, request, {reinterpret_cast<char const *>(data.data()), data.size()});
+		}
+	}
+
+	handleVariableCommand(client, request, payload);
+}
+
+void MockServer::handleVariableCommand(Endpoint const & client, RequestHeader const & request, std::string_view payload) {
+	std::optional<VariableInfo> info = variableInfo(request.command);
+	if (!info) return respond(client, request, {}, status::undefined_command);
+	std::vector<std::uint8_t> & storage = variables_[info->key];
+	std::size_t index = request.instance;
+
+	if (!info->multiple) {
+		if (index > 255) return respond(client, request, {}, status::invalid_instance);
+		std::uint8_t * variable = storage.data() + index * info->size;
+
+		if (request.service == service::get_all || request.service == service::get_single) {
+			return respond(client, request, {reinterpret_cast<char const *>(variable), info->size});
+		}
+		if (request.service == service::set_all || request.service == service::set_single) {
+			if (payload.size() != info->size) return respond(client, request, {}, status::invalid_data_size);
+			std::memcpy(variable, payload.data(), info->size);
+			return respond(client, request, {});
+		}
+		return respond(client, request, {}, status::undefined_command);
+	}
+
+	if (payload.size() < 4) return respond(client, request, {}, status::invalid_data_size);
+	std::uint32_t count = readLittleEndian<std::uint32_t>(payload);
+	if (count == 0 || index + count > 256) return respond(client, request, {}, status::invalid_instance);
+	// Like the controller, B variables can only be read and written in multiples of 2.
+	if (info->key == commands::robot::readwrite_multiple_int8 && count % 2) return respond(client, request, {}, status::invalid_data_size);
+	std::uint8_t * variables = storage.data() + index * info->size;
+
+	if (request.service == service::read_multiple) {
+		if (!payload.empty()) return respond(client, request, {}, status::invalid_data_size);
+		std::string data(4 + count * info->size, '\0');
+		storeLittleEndian(reinterpret_cast<std::uint8_t *>(data.data()), count);
+		std::memcpy(data.data() + 4, variables, count * info->size);
+		return respond(client, request, data);
+	}
+	if (request.service == service::write_multiple) {
+		if (payload.size() != count * info->size) return respond(client, request, {}, status::invalid_data_size);
+		std::memcpy(variables, payload.data(), payload.size());
+		return respond(client, request, {});
+	}
+	respond(client, request, {}, status::undefined_command);
+}
+
+void MockServer::handleFileCommand(Endpoint const & client, RequestHeader const & request, std::string_view payload) {
+	TransferKey key{client, request.request_id};
+	std::uint32_t block   = request.block_number & 0x7fffffff;
+	bool last_block       = request.block_number & 0x80000000;
+
+	switch (request.service) {
+		case commands::file::read_file_list:
+		case commands::file::read_file: {
+			// An ack for a block of a download.
+			if (request.ack) {
+				auto transfer = transfers_.find(key);
+				if (transfer == transfers_.end() || !transfer->second.download || block != transfer->second.block) return;
+				if (transfer->second.block * max_payload_size >= transfer->second.data.size()) {
+					if (transfer->second.last_block_acks_dropped < options_.drop_last_block_acks) {
+						++transfer->second.last_block_acks_dropped;
+						++statistics_.requests_dropped;
+						return;
+					}
+					++statistics_.downloads_completed;
+					transfers_.erase(transfer);
+					return;
+				}
+				++transfer->second.block;
+				transfer->second.retransmits = 0;
+				return sendBlock(key);
+			}
+
+			// A repeated request for a download in progress.
+			if (transfers_.count(key)) return;
+
+			if (request.service == commands::file::read_file_list) {
+				std::string list;
+				for (auto const & [name, data] : files_) {
+					if (!matchPattern(payload, name)) continue;
+					list.append(name);
+					list.append("\r\n");
+				}
+				return startDownload(client, request, std::move(list));
+			}
+
+			auto file = files_.find(std::string{payload});
+			if (file == files_.end()) return respond(client, request, {}, status::error, extra_status::file_not_found);
+			return startDownload(client, request, file->second);
+		}
+
+		case commands::file::write_file: {
+			auto transfer = transfers_.find(key);
+
+			// The start of an upload.
+			// A repeated request for an upload that already started is only acked again.
+			if (block == 0) {
+				if (transfer == transfers_.end() || transfer->second.download || transfer->second.name != payload) {
+					Transfer & upload = transfers_[key];
+					upload = Transfer{};
+					upload.download = false;
+					upload.request  = request;
+					upload.name     = std::string{payload};
+				}
+				return respond(client, request, {}, status::ok, 0, 0);
+			}
+
+			// A duplicate of the last block of a finished upload.
+			if (transfer == transfers_.end()) return respond(client, request, {}, status::ok, 0, request.block_number);
+
+			Transfer & upload = transfer->second;
+			if (block == upload.block + 1) {
+				upload.data.append(payload);
+				upload.block = block;
+			} else if (block > upload.block) {
+				// A block is missing, wait for the client to send it again.
+				return;
+			}
+			respond(client, request, {}, status::ok, 0, request.block_number);
+
+			if (last_block && block == upload.block) {
+				files_[std::move(upload.name)] = std::move(upload.data);
+				transfers_.erase(transfer);
+			}
+			return;
+		}
+
+		case commands::file::delete_file: {
+			if (!files_.erase(std::string{payload})) return respond(client, request, {}, status::error, extra_status::file_not_found);
+			return respond(client, request, {});
+		}
+	}
+
+	respond(client, request, {}, status::undefined_command);
+}
+
+void MockServer::startDownload(Endpoint const & client, RequestHeader const & request, std::string data) {
+	TransferKey key{client, request.request_id};
+	Transfer & transfer = transfers_[key];
+	transfer.download = true;
+	transfer.request  = request;
+	transfer.data     = std::move(data);
+	transfer.block    = 1;
+	transfer.timer    = std::make_unique<asio::steady_timer>(socket_.get_executor());
+	sendBlock(key);
+}
+
+void MockServer::sendBlock(TransferKey const & key) {
+	Transfer & transfer = transfers_.at(key);
+	std::size_t offset = (transfer.block - 1) * max_payload_size;
+	std::string_view data = std::string_view{transfer.data}.substr(offset, max_payload_size);
+	bool last_block = offset + data.size() >= transfer.data.size();
+	respond(key.first, transfer.request, data, status::ok, 0, transfer.block | (last_block ? 0x80000000 : 0));
+
+	// Send the block again if the client doesn't ack it in time.
+	transfer.timer->expires_after(options_.file_retransmit_interval);
+	transfer.timer->async_wait([this, key, block = transfer.block] (std::error_code error) {
+		if (error) return;
+		std::lock_guard<std::mutex> lock{mutex_};
+		auto transfer = transfers_.find(key);
+		if (transfer == transfers_.end() || transfer->second.block != block) return;
+		if (++transfer->second.retransmits > options_.file_max_retransmits) {
+			transfers_.erase(transfer);
+			return;
+		}
+		++statistics_.file_retransmits;
+		sendBlock(key);
+	});
+}
+
+void MockServer::respond(
+	Endpoint const & client,
+	RequestHeader const & request,
+	std::string_view payload,
+	std::uint8_t status,
+	std::uint16_t extra_status,
+	std::uint32_t block_number
+) {
+	ResponseHeader header;
+	header.payload_size = payload.size();
+	header.division     = request.division;
+	header.ack          = true;
+	header.request_id   = request.request_id;
+	header.block_number = block_number;
+	header.service      = request.service | 0x80;
+	header.status       = status;
+	header.extra_status = extra_status;
+
+	std::vector<std::uint8_t> message(header_size + payload.size());
+	std::uint8_t * data = encode(message.data(), header);
+	if (!payload.empty()) std::memcpy(data, payload.data(), payload.size());
+	send(client, std::move(message));
+}
+
+void MockServer::send(Endpoint const & client, std::vector<std::uint8_t> message) {
+	if (chance(options_.response_loss)) {
+		++statistics_.responses_dropped;
+		return;
+	}
+
+	Clock::duration delay = options_.latency;
+	if (options_.jitter.count() > 0) {
+		delay += std::chrono::microseconds{std::uniform_int_distribution<std::int64_t>{0, options_.jitter.count()}(random_)};
+	}
+	if (chance(options_.reorder)) {
+		++statistics_.responses_reordered;
+		delay += options_.reorder_delay;
+	}
+
+	// Send right away if there is no delay and nothing is waiting, to keep the order.
+	if (delay.count() == 0 && pending_.empty()) {
+		std::error_code error;
+		socket_.send_to(asio::buffer(message), client, 0, error);
+		if (!error) ++statistics_.responses_sent;
+		return;
+	}
+
+	bool earliest = pending_.empty() || Clock::now() + delay < pending_.top().time;
+	pending_.push({Clock::now() + delay, next_sequence_++, client, std::move(message)});
+	if (earliest) armSendTimer();
+}
+
+void MockServer::armSendTimer() {
+	send_timer_.expires_at(pending_.top().time);
+	send_timer_.async_wait([this] (std::error_code error) {
+		onSendTimer(error);
+	});
+}
+
+void MockServer::onSendTimer(std::error_code error) {
+	if (error) return;
+	std::lock_guard<std::mutex> lock{mutex_};
+
+	Clock::time_point now = Clock::now();
+	while (!pending_.empty() && pending_.top().time <= now) {
+		PendingMessage const & message = pending_.top();
+		std::error_code error;
+		socket_.send_to(asio::buffer(message.data), message.endpoint, 0, error);
+		if (!error) ++statistics_.responses_sent;
+		pending_.pop();
+	}
+
+	if (!pending_.empty()) armSendTimer();
+}
+
+bool MockServer::chance(double probability) {
+	if (probability <= 0) return false;
+	return std::uniform_real_distribution<double>{0, 1}(random_) < probability;
+}
+
+}}}
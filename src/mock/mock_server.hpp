@@ -0,0 +1,277 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "types.hpp"
+#include "udp/message.hpp"
+
+#include <asio/io_service.hpp>
+#include <asio/ip/udp.hpp>
+#include <asio/steady_timer.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+/// Network impairments and timing of the mock server.
+struct MockServerOptions {
+	/// Delay before each response is sent.
+	std::chrono::microseconds latency{0};
+
+	/// Maximum random delay added to the latency of each response.
+	std::chrono::microseconds jitter{0};
+
+	/// Probability that an incoming message is dropped.
+	double request_loss = 0;
+
+	/// Probability that an outgoing message is dropped.
+	double response_loss = 0;
+
+	/// Probability that an outgoing message is held back, so that later messages overtake it.
+	double reorder = 0;
+
+	/// Extra delay for messages that are held back.
+	std::chrono::microseconds reorder_delay{2000};
+
+	/// Time to wait for an ack before a block of a file download is sent again.
+	std::chrono::milliseconds file_retransmit_interval{50};
+
+	/// Number of times a block of a file download is sent again before the download is abandoned.
+	unsigned int file_max_retransmits = 20;
+
+	/// Number of acks for the last block of each download to ignore, as if they were lost.
+	unsigned int drop_last_block_acks = 0;
+
+	/// Seed for the random number generator, so runs with impairments are reproducible.
+	std::uint32_t seed = 1;
+};
+
+/// Mock of the High Speed Ethernet Server of a robot controller.
+/**
+ * The mock implements the parts of the protocol that the client uses:
+ * - the robot division: status, current position and B, I, D, R and P variables (single and multiple);
+ * - the file division: file list, download, upload and delete.
+ *
+ * Responses can be delayed, dropped and reordered to test and benchmark the client without a real controller.
+ * All impairments are driven by a seeded random number generator.
+ *
+ * The server runs on the io_service it was created with.
+ * The functions to inspect and modify the controller state may be called from any thread.
+ * The io_service must be stopped before the server is destroyed.
+ */
+class MockServer {
+public:
+	using Endpoint = asio::ip::udp::endpoint;
+	using Clock    = std::chrono::steady_clock;
+
+	/// Message counters.
+	struct Statistics {
+		std::size_t requests_received  = 0;
+		std::size_t requests_dropped   = 0;
+		std::size_t responses_sent     = 0;
+		std::size_t responses_dropped  = 0;
+		std::size_t responses_reordered = 0;
+		std::size_t file_retransmits   = 0;
+		std::size_t downloads_completed = 0;
+	};
+
+private:
+	/// A response waiting for its send time.
+	struct PendingMessage {
+		Clock::time_point time;
+		std::uint64_t sequence;
+		Endpoint endpoint;
+		std::vector<std::uint8_t> data;
+
+		/// Order messages so that the earliest is on top of the heap.
+		friend bool operator<(PendingMessage const & a, PendingMessage const & b) {
+			if (a.time != b.time) return a.time > b.time;
+			return a.sequence > b.sequence;
+		}
+	};
+
+	/// A file download or upload in progress.
+	struct Transfer {
+		bool download;
+		RequestHeader request;
+		std::string name;
+		std::string data;
+
+		/// For downloads, the block waiting for an ack. For uploads, the last block received.
+		std::uint32_t block = 0;
+
+		/// The number of times the current block of a download has been sent again.
+		unsigned int retransmits = 0;
+
+		/// The number of acks for the last block of a download that were ignored.
+		unsigned int last_block_acks_dropped = 0;
+
+		/// Timer to send the current block of a download again.
+		std::unique_ptr<asio::steady_timer> timer;
+	};
+
+	using TransferKey = std::pair<Endpoint, std::uint8_t>;
+
+	MockServerOptions options_;
+	asio::ip::udp::socket socket_;
+	asio::steady_timer send_timer_;
+
+	std::array<std::uint8_t, 2048> read_buffer_;
+	Endpoint sender_;
+
+	std::mt19937 random_;
+	std::priority_queue<PendingMessage> pending_;
+	std::uint64_t next_sequence_ = 0;
+
+	/// Protects everything below.
+	mutable std::mutex mutex_;
+
+	Statistics statistics_;
+	std::array<std::uint8_t, 8> status_{};
+	Position position_;
+
+	/// Variables, encoded as they are sent over the wire, indexed by the multiple read/write command.
+	std::map<std::uint16_t, std::vector<std::uint8_t>> variables_;
+
+	std::map<std::string, std::string> files_;
+	std::map<TransferKey, Transfer> transfers_;
+
+public:
+	/// Create a mock server listening on the given endpoint.
+	/**
+	 * By default the server listens on a free port on the loopback interface.
+	 * Use endpoint() to get the actual endpoint.
+	 */
+	explicit MockServer(
+		asio::io_service & ios,
+		MockServerOptions options = {},
+		Endpoint endpoint = {asio::ip::address_v4::loopback(), 0}
+	);
+
+	MockServer(MockServer const &) = delete;
+	MockServer & operator=(MockServer const &) = delete;
+
+	/// Get the endpoint the server is listening on.
+	Endpoint endpoint() const { return socket_.local_endpoint(); }
+
+	/// Start serving requests.
+	void start();
+
+	/// Stop serving requests and close the socket.
+	void stop();
+
+	/// Get the message counters.
+	Statistics statistics() const;
+
+	/// Set the status reported by the controller.
+	void setStatus(Status const & status);
+
+	/// Set the position reported by the controller.
+	void setPosition(Position const & position);
+
+	/// Set a variable.
+	/**
+	 * Supported types are the variable types of the client:
+	 * std::uint8_t, std::int16_t, std::int32_t, float and Position.
+	 */
+	template<typename T>
+	void setVariable(std::uint8_t index, T const & value);
+
+	/// Get a variable.
+	template<typename T>
+	T variable(std::uint8_t index) const;
+
+	/// Add or replace a file.
+	void setFile(std::string name, std::string data);
+
+	/// Get a file, if it exists.
+	std::optional<std::string> file(std::string const & name) const;
+
+private:
+	/// Wait for the next message.
+	void receive();
+
+	/// Called when a message has been received.
+	void onReceive(std::error_code error, std::size_t size);
+
+	/// Process a request.
+	void handleMessage(Endpoint const & client, std::string_view message);
+
+	/// Process a request for the robot division.
+	void handleRobotCommand(Endpoint const & client, RequestHeader const & request, std::string_view payload);
+
+	/// Process a request for the file division.
+	void handleFileCommand(Endpoint const & client, RequestHeader const & request, std::string_view payload);
+
+	/// Process a variable read or write request.
+	void handleVariableCommand(Endpoint const & client, RequestHeader const & request, std::string_view payload);
+
+	/// Start a file download.
+	void startDownload(Endpoint const & client, RequestHeader const & request, std::string data);
+
+	/// Send the current block of a download and schedule a retransmission.
+	void sendBlock(TransferKey const & key);
+
+	/// Send a response to a request.
+	void respond(
+		Endpoint const & client,
+		RequestHeader const & request,
+		std::string_view payload,
+		std::uint8_t status = 0,
+		std::uint16_t extra_status = 0,
+		std::uint32_t block_number = 0
+	);
+
+	/// Send a message with the configured impairments.
+	void send(Endpoint const & client, std::vector<std::uint8_t> message);
+
+	/// Arm the send timer for the earliest pending message.
+	void armSendTimer();
+
+	/// Send all pending messages that are due.
+	void onSendTimer(std::error_code error);
+
+	/// Return true with the given probability.
+	bool chance(double probability);
+};
+
+}}}
@@ -46,6 +46,20 @@ RpcServer::RpcServer(udp::Client & client, std::uint8_t base_register, std::chro
 
 bool RpcServer::start() {
 	if (started_.exchange(true)) return false;
+
+	// Without services there are no status registers to poll.
+	polled_services_ = services_.size();
+	if (polled_services_ == 0) return true;
+
+	// We must read a multiple of 2 B vars :/
+	// The read command is prepared once, since it is sent over and over.
+	// It is only encoded again when services were added since the last start.
+	std::size_t count = (polled_services_ + 1) / 2 * 2;
+	ReadUint8VarsInto command{base_register_, {statuses_.data(), count}};
+	if (!read_statuses_) read_statuses_.emplace(command);
+	else if (read_count_ != count) read_statuses_->update(command);
+	read_count_ = count;
+
 	readCommands();
 	return true;
 }
@@ -75,22 +89,18 @@ void RpcServer::startReadCommandsTimer() {
 }
 
 void RpcServer::readCommands() {
-	// We must read a multiple of 2 B vars :/
-	std::size_t size = services_.size();
-	std::uint8_t count = (size + 1) / 2 * 2;
-
 	// Read command registers.
-	client_->sendCommand(ReadUint8Vars{base_register_, count}, 100ms, [this, size] (Result<std::vector<std::uint8_t>> const & statuses) {
+	client_->sendCommand(*read_statuses_, 100ms, [this] (Result<void> const & result) {
 		// Report error
-		if (!statuses) {
-			on_error_(std::move(statuses.error_unchecked()).push_description("reading commands status variables"));
+		if (!result) {
+			on_error_(std::move(result.error_unchecked()).push_description("reading commands status variables"));
 			if (started_) startReadCommandsTimer();
 			return;
 		}
 
 		// Check each status register for requested service calls.
-		for (std::size_t i = 0; i < size; ++i) {
-			if (statuses->operator[](i) == service_status::requested) execute(i);
+		for (std::size_t i = 0; i < polled_services_; ++i) {
+			if (statuses_[i] == service_status::requested) execute(i);
 		}
 
 		// Read status registers again until started_ becomes false.
@@ -0,0 +1,153 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "udp/impl/send_multiple_commands.hpp"
+#include "commands.hpp"
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <ostream>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+namespace impl {
+
+/// The result of planning a tuple of commands.
+struct PlanResult {
+	std::vector<int> group_size;
+	std::size_t requests;
+
+	bool operator==(PlanResult const & other) const { return group_size == other.group_size && requests == other.requests; }
+};
+
+std::ostream & operator<<(std::ostream & stream, PlanResult const & plan) {
+	stream << "{{";
+	for (std::size_t i = 0; i < plan.group_size.size(); ++i) stream << (i ? ", " : "") << plan.group_size[i];
+	return stream << "}, " << plan.requests << "}";
+}
+
+/// Plan a tuple of commands.
+template<typename... Commands>
+PlanResult plan(Commands const & ... commands) {
+	using Tuple = std::tuple<Commands...>;
+	auto plan = MultiCommandSession<Tuple>::plan(Tuple{commands...});
+	return {{plan.group_size.begin(), plan.group_size.end()}, plan.requests};
+}
+
+/// Plan a tuple of N commands for consecutive variables.
+template<typename Command, std::size_t... I>
+PlanResult planConsecutive(std::uint8_t first, std::index_sequence<I...>) {
+	return plan(Command{std::uint8_t(first + I)}...);
+}
+
+/// Make a vector of group sizes for a single group followed by a number of others.
+std::vector<int> groups(std::vector<std::pair<int, int>> sizes) {
+	std::vector<int> result;
+	for (auto [size, repeat] : sizes) {
+		for (int i = 0; i < repeat; ++i) {
+			result.push_back(size);
+			for (int j = 1; j < size; ++j) result.push_back(0);
+		}
+	}
+	return result;
+}
+
+TEST(CoalescePlan, single) {
+	ASSERT_EQ(plan(ReadInt32Var{4}), (PlanResult{{1}, 1}));
+	ASSERT_EQ(plan(ReadStatus{}), (PlanResult{{1}, 1}));
+}
+
+TEST(CoalescePlan, adjacentIndices) {
+	ASSERT_EQ(plan(ReadInt32Var{4}, ReadInt32Var{5}, ReadInt32Var{6}), (PlanResult{{3, 0, 0}, 1}));
+	ASSERT_EQ(plan(WriteFloat32Var{0, 1}, WriteFloat32Var{1, 2}), (PlanResult{{2, 0}, 1}));
+}
+
+TEST(CoalescePlan, nonAdjacentIndices) {
+	ASSERT_EQ(plan(ReadInt32Var{4}, ReadInt32Var{6}), (PlanResult{{1, 1}, 2}));
+	ASSERT_EQ(plan(ReadInt32Var{5}, ReadInt32Var{4}), (PlanResult{{1, 1}, 2}));
+	ASSERT_EQ(plan(ReadInt32Var{4}, ReadInt32Var{4}), (PlanResult{{1, 1}, 2}));
+	ASSERT_EQ(plan(ReadInt32Var{1}, ReadInt32Var{2}, ReadInt32Var{4}, ReadInt32Var{5}), (PlanResult{{2, 0, 2, 0}, 2}));
+}
+
+TEST(CoalescePlan, mixedTypes) {
+	// Reads and writes are never coalesced with each other.
+	ASSERT_EQ(plan(ReadInt32Var{4}, WriteInt32Var{5, 1}), (PlanResult{{1, 1}, 2}));
+	ASSERT_EQ(plan(WriteInt32Var{4, 1}, ReadInt32Var{5}), (PlanResult{{1, 1}, 2}));
+
+	// Neither are different variable types.
+	ASSERT_EQ(plan(ReadInt32Var{4}, ReadInt16Var{5}), (PlanResult{{1, 1}, 2}));
+	ASSERT_EQ(plan(ReadInt32Var{4}, ReadFloat32Var{5}), (PlanResult{{1, 1}, 2}));
+
+	// Or commands separated by a different command.
+	ASSERT_EQ(plan(ReadInt32Var{4}, ReadStatus{}, ReadInt32Var{5}), (PlanResult{{1, 1, 1}, 3}));
+	ASSERT_EQ(plan(ReadInt32Var{4}, ReadInt32Var{5}, ReadInt16Var{6}, ReadInt16Var{7}), (PlanResult{{2, 0, 2, 0}, 2}));
+}
+
+TEST(CoalescePlan, evenUint8Groups) {
+	ASSERT_EQ(plan(ReadUint8Var{0}, ReadUint8Var{1}), (PlanResult{{2, 0}, 1}));
+	ASSERT_EQ(plan(ReadUint8Var{0}, ReadUint8Var{1}, ReadUint8Var{2}, ReadUint8Var{3}), (PlanResult{{4, 0, 0, 0}, 1}));
+	ASSERT_EQ(plan(WriteUint8Var{0, 1}, WriteUint8Var{1, 2}), (PlanResult{{2, 0}, 1}));
+}
+
+TEST(CoalescePlan, splitOddUint8Groups) {
+	// The last command of an odd group is sent on its own.
+	ASSERT_EQ(plan(ReadUint8Var{0}, ReadUint8Var{1}, ReadUint8Var{2}), (PlanResult{{2, 0, 1}, 2}));
+	ASSERT_EQ(plan(WriteUint8Var{0, 1}, WriteUint8Var{1, 2}, WriteUint8Var{2, 3}), (PlanResult{{2, 0, 1}, 2}));
+
+	// Also when the odd group is followed by other commands.
+	ASSERT_EQ(plan(ReadUint8Var{0}, ReadUint8Var{1}, ReadUint8Var{2}, ReadInt32Var{0}), (PlanResult{{2, 0, 1, 1}, 3}));
+	ASSERT_EQ(plan(ReadUint8Var{0}, ReadUint8Var{1}, ReadUint8Var{2}, ReadUint8Var{5}, ReadUint8Var{6}), (PlanResult{{2, 0, 1, 2, 0}, 3}));
+	ASSERT_EQ(plan(ReadUint8Var{0}, ReadUint8Var{1}, ReadUint8Var{2}, ReadUint8Var{5}, ReadUint8Var{6}, ReadUint8Var{7}), (PlanResult{{2, 0, 1, 2, 0, 1}, 4}));
+}
+
+TEST(CoalescePlan, splitAtMaxCount) {
+	static_assert(max_coalesced_count<Position> == 9);
+	ASSERT_EQ(planConsecutive<ReadPositionVar>(0, std::make_index_sequence<9>{}), (PlanResult{groups({{9, 1}}), 1}));
+	ASSERT_EQ(planConsecutive<ReadPositionVar>(0, std::make_index_sequence<10>{}), (PlanResult{groups({{9, 1}, {1, 1}}), 2}));
+	ASSERT_EQ(planConsecutive<ReadPositionVar>(0, std::make_index_sequence<20>{}), (PlanResult{groups({{9, 2}, {2, 1}}), 3}));
+
+	static_assert(max_coalesced_count<std::int32_t> == 118);
+	ASSERT_EQ(planConsecutive<ReadInt32Var>(0, std::make_index_sequence<120>{}), (PlanResult{groups({{118, 1}, {2, 1}}), 2}));
+}
+
+TEST(CoalescePlan, splitUint8AtMaxCount) {
+	// The maximum group size for B variables is odd, so a full group is split too.
+	static_assert(max_coalesced_count<std::uint8_t> == 255);
+	ASSERT_EQ(planConsecutive<ReadUint8Var>(0, std::make_index_sequence<256>{}), (PlanResult{groups({{254, 1}, {1, 2}}), 3}));
+}
+
+}}}}
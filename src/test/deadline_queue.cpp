@@ -0,0 +1,161 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "udp/impl/deadline_queue.hpp"
+#include <gtest/gtest.h>
+
+#include <asio/io_service.hpp>
+#include <asio/strand.hpp>
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+namespace impl {
+
+using namespace std::chrono_literals;
+
+class DeadlineQueueTest : public testing::Test {
+protected:
+	asio::io_service ios;
+	DeadlineQueue queue{asio::make_strand(ios), std::make_shared<SessionPool>()};
+
+	/// The order in which deadlines expired.
+	std::vector<int> expired;
+
+	/// Schedule a deadline that records its id when it expires.
+	DeadlineQueue::Token add(int id, std::chrono::steady_clock::duration timeout) {
+		return queue.add(std::chrono::steady_clock::now() + timeout, [this, id] () { expired.push_back(id); });
+	}
+
+	/// Run until a number of deadlines expired, or until there is no more work.
+	void runUntilExpired(std::size_t count) {
+		while (expired.size() < count && ios.run_one()) {}
+	}
+};
+
+TEST_F(DeadlineQueueTest, expiresInOrder) {
+	add(3, 30ms);
+	add(1, 10ms);
+	add(2, 20ms);
+	runUntilExpired(3);
+	ASSERT_EQ(expired, (std::vector<int>{1, 2, 3}));
+}
+
+TEST_F(DeadlineQueueTest, expiresPassedDeadlines) {
+	add(2, -1ms);
+	add(1, -2ms);
+	add(3, 0ms);
+	runUntilExpired(3);
+	ASSERT_EQ(expired, (std::vector<int>{1, 2, 3}));
+}
+
+TEST_F(DeadlineQueueTest, cancelHead) {
+	DeadlineQueue::Token head = add(1, 10ms);
+	add(2, 20ms);
+	queue.cancel(head);
+
+	// The timer is still armed for the cancelled head, and must be re-armed for the next deadline.
+	runUntilExpired(1);
+	ASSERT_EQ(expired, (std::vector<int>{2}));
+	ASSERT_EQ(ios.poll(), 0u);
+}
+
+TEST_F(DeadlineQueueTest, cancelMiddle) {
+	add(1, 10ms);
+	DeadlineQueue::Token middle = add(2, 20ms);
+	add(3, 30ms);
+	queue.cancel(middle);
+	runUntilExpired(2);
+	ASSERT_EQ(expired, (std::vector<int>{1, 3}));
+}
+
+TEST_F(DeadlineQueueTest, cancelAll) {
+	DeadlineQueue::Token a = add(1, 10ms);
+	DeadlineQueue::Token b = add(2, 20ms);
+	queue.cancel(b);
+	queue.cancel(a);
+	ios.run();
+	ASSERT_EQ(expired, std::vector<int>{});
+}
+
+TEST_F(DeadlineQueueTest, staleTokenDoesNotCancelReusedEntry) {
+	DeadlineQueue::Token first = add(1, 10ms);
+	queue.cancel(first);
+
+	// The entry of the cancelled deadline is re-used with a new generation.
+	DeadlineQueue::Token second = add(2, 10ms);
+	ASSERT_EQ(second.index, first.index);
+	ASSERT_NE(second.generation, first.generation);
+
+	queue.cancel(first);
+	runUntilExpired(1);
+	ASSERT_EQ(expired, (std::vector<int>{2}));
+
+	// Cancelling after expiry does nothing either.
+	queue.cancel(second);
+	DeadlineQueue::Token third = add(3, 10ms);
+	queue.cancel(second);
+	runUntilExpired(2);
+	ASSERT_EQ(expired, (std::vector<int>{2, 3}));
+	ASSERT_EQ(third.index, first.index);
+}
+
+TEST_F(DeadlineQueueTest, defaultTokenCancelsNothing) {
+	add(1, 10ms);
+	queue.cancel(DeadlineQueue::Token{});
+	runUntilExpired(1);
+	ASSERT_EQ(expired, (std::vector<int>{1}));
+}
+
+TEST_F(DeadlineQueueTest, earlierDeadlineRearmsTimer) {
+	add(2, 10s);
+	add(1, 10ms);
+	runUntilExpired(1);
+	ASSERT_EQ(expired, (std::vector<int>{1}));
+}
+
+TEST_F(DeadlineQueueTest, addFromExpiringDeadline) {
+	queue.add(std::chrono::steady_clock::now() + 10ms, [this] () {
+		expired.push_back(1);
+		add(2, 10ms);
+	});
+	runUntilExpired(2);
+	ASSERT_EQ(expired, (std::vector<int>{1, 2}));
+}
+
+}}}}
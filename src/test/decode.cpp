@@ -0,0 +1,158 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../udp/encode.hpp"
+#include "udp/protocol.hpp"
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+/// Decode a file list and copy the names, so they can be compared easily.
+std::vector<std::string> decodeFileList(std::string data) {
+	Result<FileList> list = decode(ResponseHeader{}, std::move(data), ReadFileList{"*.JBI"});
+	EXPECT_TRUE(list);
+	if (!list) return {};
+	return {list->begin(), list->end()};
+}
+
+TEST(DecodeFileList, empty) {
+	ASSERT_EQ(decodeFileList(""), std::vector<std::string>{});
+	ASSERT_EQ(decodeFileList("\r\n"), std::vector<std::string>{});
+}
+
+TEST(DecodeFileList, crlfTerminated) {
+	ASSERT_EQ(decodeFileList("A.JBI\r\nB.JBI\r\nLONG_JOB_NAME_123.JBI\r\n"), (std::vector<std::string>{"A.JBI", "B.JBI", "LONG_JOB_NAME_123.JBI"}));
+}
+
+TEST(DecodeFileList, unterminatedLastName) {
+	ASSERT_EQ(decodeFileList("A.JBI\r\nB.JBI"), (std::vector<std::string>{"A.JBI", "B.JBI"}));
+	ASSERT_EQ(decodeFileList("A"), (std::vector<std::string>{"A"}));
+}
+
+TEST(DecodeFileList, skipsEmptyNames) {
+	ASSERT_EQ(decodeFileList("\r\nA.JBI\r\n\r\nB.JBI\r\n"), (std::vector<std::string>{"A.JBI", "B.JBI"}));
+}
+
+TEST(DecodeFileList, bareCarriageReturnIsPartOfName) {
+	ASSERT_EQ(decodeFileList("A\rB\r\nC\r"), (std::vector<std::string>{"A\rB", "C\r"}));
+}
+
+TEST(DecodeFileList, manyNames) {
+	std::string data;
+	for (int i = 0; i < 5000; ++i) data += "JOB" + std::to_string(i) + ".JBI\r\n";
+
+	Result<FileList> list = decode(ResponseHeader{}, std::move(data), ReadFileList{"*.JBI"});
+	ASSERT_TRUE(list);
+	ASSERT_EQ(list->size(), 5000u);
+	ASSERT_EQ((*list)[0], "JOB0.JBI");
+	ASSERT_EQ((*list)[4999], "JOB4999.JBI");
+}
+
+/// Encode the payload of a ReadVars response, optionally without the value count.
+template<typename T>
+std::string encodeVars(std::vector<T> const & values, bool with_count = true) {
+	std::vector<std::uint8_t> data(4 + values.size() * 52);
+	std::uint8_t * out = data.data();
+	if (with_count) out = encode(out, std::int32_t(values.size()));
+	for (T const & value : values) out = encode(out, value);
+	return std::string(data.begin(), data.begin() + (out - data.data()));
+}
+
+/// Decode a variable command from a complete payload.
+template<typename Command>
+Result<typename Command::Response> decodeVars(std::string const & data, Command const & command) {
+	std::string_view view = data;
+	return decode(ResponseHeader{}, view, command);
+}
+
+TEST(DecodeReadVars, bulkScalars) {
+	ASSERT_EQ(*decodeVars(encodeVars<std::int32_t>({-1, 2, 0x12345678}), ReadInt32Vars{0, 3}), (std::vector<std::int32_t>{-1, 2, 0x12345678}));
+	ASSERT_EQ(*decodeVars(encodeVars<std::int16_t>({-2, 300}), ReadInt16Vars{0, 2}), (std::vector<std::int16_t>{-2, 300}));
+	ASSERT_EQ(*decodeVars(encodeVars<std::uint8_t>({1, 2, 3, 255}), ReadUint8Vars{0, 4}), (std::vector<std::uint8_t>{1, 2, 3, 255}));
+	ASSERT_EQ(*decodeVars(encodeVars<float>({0.5f, -1.25f}), ReadFloat32Vars{0, 2}), (std::vector<float>{0.5f, -1.25f}));
+
+	std::vector<std::int32_t> many(118);
+	for (std::size_t i = 0; i < many.size(); ++i) many[i] = std::int32_t(i * 1000003);
+	ASSERT_EQ(*decodeVars(encodeVars(many), ReadInt32Vars{0, 118}), many);
+}
+
+TEST(DecodeReadVars, singleValueHasNoCount) {
+	ASSERT_EQ(*decodeVars(encodeVars<std::int32_t>({7}, false), ReadInt32Vars{0, 1}), (std::vector<std::int32_t>{7}));
+	ASSERT_FALSE(decodeVars(encodeVars<std::int32_t>({7}), ReadInt32Vars{0, 1}));
+}
+
+TEST(DecodeReadVars, positions) {
+	std::vector<Position> positions{
+		PulsePosition{std::array<int, 8>{{1, 2, 3, 4, 5, 6, 7, 8}}, 2},
+		PulsePosition{std::array<int, 8>{{-1, -2, -3, -4, -5, -6, -7, -8}}, 2},
+	};
+	Result<std::vector<Position>> decoded = decodeVars(encodeVars(positions), ReadPositionVars{0, 2});
+	ASSERT_TRUE(decoded);
+	ASSERT_TRUE(*decoded == positions);
+}
+
+TEST(DecodeReadVars, wrongLength) {
+	std::string data = encodeVars<std::int32_t>({1, 2, 3});
+	ASSERT_FALSE(decodeVars(data.substr(0, data.size() - 1), ReadInt32Vars{0, 3}));
+	ASSERT_FALSE(decodeVars(data + '\0', ReadInt32Vars{0, 3}));
+	ASSERT_FALSE(decodeVars(data.substr(0, 4), ReadInt32Vars{0, 3}));
+	ASSERT_FALSE(decodeVars(std::string{}, ReadInt32Vars{0, 3}));
+	ASSERT_FALSE(decodeVars(data, ReadInt32Vars{0, 2}));
+	ASSERT_FALSE(decodeVars(data, ReadInt16Vars{0, 3}));
+}
+
+TEST(DecodeReadVars, wrongCount) {
+	// The size matches the request, but the value count in the response does not.
+	std::string data = encodeVars<std::int32_t>({1, 2, 3});
+	data[0] = 2;
+	ASSERT_FALSE(decodeVars(data, ReadInt32Vars{0, 3}));
+}
+
+TEST(DecodeReadVars, into) {
+	std::array<std::int16_t, 3> values{};
+	ASSERT_TRUE(decodeVars(encodeVars<std::int16_t>({4, -5, 6}), ReadInt16VarsInto{0, {values.data(), values.size()}}));
+	ASSERT_EQ(values, (std::array<std::int16_t, 3>{{4, -5, 6}}));
+
+	std::string data = encodeVars<std::int16_t>({4, -5});
+	ASSERT_FALSE(decodeVars(data, ReadInt16VarsInto{0, {values.data(), values.size()}}));
+}
+
+}}}
@@ -0,0 +1,102 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../udp/encode.hpp"
+#include "udp/protocol.hpp"
+#include <gtest/gtest.h>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+using Bytes = std::vector<std::uint8_t>;
+
+/// Build an encoded header byte by byte, the same way the protocol documentation lists it.
+Bytes expectedHeader(std::uint16_t payload_size, Division division, bool ack, std::uint8_t request_id, std::uint32_t block_number, std::uint16_t command, std::uint16_t instance, std::uint8_t attribute, std::uint8_t service) {
+	return {
+		'Y', 'E', 'R', 'C',
+		0x20, 0x00,
+		std::uint8_t(payload_size), std::uint8_t(payload_size >> 8),
+		3,
+		std::uint8_t(division),
+		ack,
+		request_id,
+		std::uint8_t(block_number), std::uint8_t(block_number >> 8), std::uint8_t(block_number >> 16), std::uint8_t(block_number >> 24),
+		'9', '9', '9', '9', '9', '9', '9', '9',
+		std::uint8_t(command), std::uint8_t(command >> 8),
+		std::uint8_t(instance), std::uint8_t(instance >> 8),
+		attribute,
+		service,
+		0, 0,
+	};
+}
+
+TEST(Encode, requestHeader) {
+	Bytes output;
+	encode(output, makeFileRequestHeader(0x1df, commands::file::read_file, 0x42, 0x80000003, true));
+	ASSERT_EQ(output, expectedHeader(0x1df, Division::file, true, 0x42, 0x80000003, 0, 0, 0, commands::file::read_file));
+}
+
+TEST(Encode, readVar) {
+	Bytes output;
+	encode(output, 7, ReadInt32Var{123});
+	ASSERT_EQ(output, expectedHeader(0, Division::robot, false, 7, 0, commands::robot::readwrite_int32_variable, 123, 0, service::get_all));
+}
+
+TEST(Encode, writeVar) {
+	Bytes output;
+	encode(output, 9, WriteFloat32Var{3, 1.5f});
+	Bytes expected = expectedHeader(4, Division::robot, false, 9, 0, commands::robot::readwrite_float_variable, 3, 0, service::set_all);
+	expected.insert(expected.end(), {0x00, 0x00, 0xc0, 0x3f});
+	ASSERT_EQ(output, expected);
+}
+
+TEST(Encode, writeVars) {
+	Bytes output;
+	encode(output, 200, WriteInt16Vars{10, {1, -2, 0x1234}});
+	Bytes expected = expectedHeader(10, Division::robot, false, 200, 0, commands::robot::readwrite_multiple_int16, 10, 0, service::write_multiple);
+	expected.insert(expected.end(), {3, 0, 0, 0, 0x01, 0x00, 0xfe, 0xff, 0x34, 0x12});
+	ASSERT_EQ(output, expected);
+}
+
+TEST(Encode, appendsToExistingData) {
+	Bytes output = {1, 2, 3};
+	encode(output, 1, ReadFile{"JOB.JBI"});
+	Bytes expected = {1, 2, 3};
+	Bytes header   = expectedHeader(7, Division::file, false, 1, 0, 0, 0, 0, commands::file::read_file);
+	expected.insert(expected.end(), header.begin(), header.end());
+	expected.insert(expected.end(), {'J', 'O', 'B', '.', 'J', 'B', 'I'});
+	ASSERT_EQ(output, expected);
+}
+
+}}}
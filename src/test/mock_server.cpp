@@ -0,0 +1,838 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../mock/mock_server.hpp"
+#include "rpc_server/rpc_server.hpp"
+#include "udp/client.hpp"
+#include "udp/file_transfer_manager.hpp"
+#include "udp/subscription.hpp"
+
+#include <asio/executor_work_guard.hpp>
+#include <asio/post.hpp>
+#include <asio/steady_timer.hpp>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <unistd.h>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+using namespace std::chrono_literals;
+
+/// Fixture running a mock server in a background thread and a client in the test thread.
+class MockServerTest : public testing::Test {
+protected:
+	asio::io_service server_ios;
+	std::unique_ptr<MockServer> server;
+	std::thread server_thread;
+
+	asio::io_service ios;
+	Client client{ios};
+
+	void startServer(MockServerOptions options = {}) {
+		server = std::make_unique<MockServer>(server_ios, options);
+		server->start();
+		server_thread = std::thread([this] () { server_ios.run(); });
+
+		std::optional<Error> connected;
+		client.connect("127.0.0.1", server->endpoint().port(), 1s, [&] (Error error) { connected = error; });
+		ASSERT_FALSE(wait(connected));
+	}
+
+	void TearDown() override {
+		client.close();
+		if (server_thread.joinable()) {
+			server_ios.stop();
+			server_thread.join();
+		}
+	}
+
+	/// Run the client until a result is available.
+	template<typename T>
+	T wait(std::optional<T> & result) {
+		while (!result && ios.run_one()) {}
+		return std::move(*result);
+	}
+
+	/// Run the client for a fixed amount of time.
+	void runFor(std::chrono::steady_clock::duration duration) {
+		std::optional<std::error_code> expired;
+		asio::steady_timer timer{ios, duration};
+		timer.async_wait([&] (std::error_code error) { expired = error; });
+		ASSERT_FALSE(wait(expired));
+	}
+
+	/// Send a command and wait for the result.
+	template<typename Command>
+	Result<typename Command::Response> execute(Command command) {
+		std::optional<Result<typename Command::Response>> result;
+		client.sendCommand(std::move(command), 1s, [&] (Result<typename Command::Response> response) {
+			result = std::move(response);
+		});
+		return wait(result);
+	}
+
+	/// Send a tuple of commands and wait for the result.
+	template<typename... Commands>
+	MultiCommandResult<std::tuple<Commands...>> executeAll(Commands... commands) {
+		std::optional<MultiCommandResult<std::tuple<Commands...>>> result;
+		client.sendCommands(std::make_tuple(std::move(commands)...), 1s, [&] (MultiCommandResult<std::tuple<Commands...>> response) {
+			result = std::move(response);
+		});
+		return wait(result);
+	}
+
+	/// Send a prepared command and wait for the result.
+	template<typename Command>
+	Result<typename Command::Response> execute(PreparedCommand<Command> const & command) {
+		std::optional<Result<typename Command::Response>> result;
+		client.sendCommand(command, 1s, [&] (Result<typename Command::Response> response) {
+			result = std::move(response);
+		});
+		return wait(result);
+	}
+
+	Result<void> writeFile(std::string name, std::string data) {
+		std::optional<Result<void>> result;
+		client.writeFile(std::move(name), std::move(data), 10s, [&] (Result<void> response) { result = std::move(response); }, nullptr);
+		return wait(result);
+	}
+
+	Result<std::string> readFile(std::string name) {
+		std::optional<Result<std::string>> result;
+		client.readFile(std::move(name), 10s, [&] (Result<std::string> response) { result = std::move(response); }, nullptr);
+		return wait(result);
+	}
+
+	/// Make file data that is not the same for every block.
+	static std::string makeData(std::size_t size) {
+		std::string result(size, '\0');
+		for (std::size_t i = 0; i < size; ++i) result[i] = 'a' + (i * 7) % 26;
+		return result;
+	}
+};
+
+TEST_F(MockServerTest, variables) {
+	startServer();
+
+	ASSERT_TRUE(execute(WriteInt32Var{7, -123}));
+	ASSERT_EQ(server->variable<std::int32_t>(7), -123);
+	ASSERT_EQ(*execute(ReadInt32Var{7}), -123);
+
+	server->setVariable<float>(3, 1.5f);
+	server->setVariable<float>(4, 2.5f);
+	server->setVariable<float>(5, 3.5f);
+	ASSERT_EQ(*execute(ReadFloat32Vars{3, 3}), (std::vector<float>{1.5f, 2.5f, 3.5f}));
+
+	ASSERT_TRUE(execute(WriteInt16Vars{10, {1, -2, 3}}));
+	std::array<std::int16_t, 3> values;
+	ASSERT_TRUE(execute(ReadInt16VarsInto{10, {values.data(), values.size()}}));
+	ASSERT_EQ(values, (std::array<std::int16_t, 3>{{1, -2, 3}}));
+
+	Position position = PulsePosition{std::array<int, 8>{{1, 2, 3, 4, 5, 6, 7, 8}}, 2};
+	ASSERT_TRUE(execute(WritePositionVar{1, position}));
+	ASSERT_EQ(*execute(ReadPositionVar{1}), position);
+}
+
+TEST_F(MockServerTest, oddUint8CountRejected) {
+	startServer();
+
+	// The controller only reads and writes multiple B variables in multiples of 2, and so does the mock.
+	ASSERT_FALSE(execute(ReadUint8Vars{0, 3}));
+	ASSERT_FALSE(execute(WriteUint8Vars{0, {1, 2, 3}}));
+	ASSERT_TRUE(execute(WriteUint8Vars{0, {1, 2, 3, 4}}));
+	ASSERT_EQ(*execute(ReadUint8Vars{0, 4}), (std::vector<std::uint8_t>{1, 2, 3, 4}));
+}
+
+TEST_F(MockServerTest, commandsFromManyThreads) {
+	startServer();
+	server->setVariable<std::int32_t>(3, 33);
+	server->setVariable<std::int16_t>(1, 11);
+
+	// Run the client on several threads, and submit work from several other threads.
+	auto work = asio::make_work_guard(ios);
+	std::vector<std::thread> io_threads;
+	for (int i = 0; i < 3; ++i) io_threads.emplace_back([this] () { ios.run(); });
+
+	constexpr std::size_t submitters = 4;
+	constexpr std::size_t iterations = 50;
+	std::array<std::atomic<int>, submitters * iterations * 2> calls{};
+	std::atomic<int> failures{0};
+
+	std::vector<std::thread> threads;
+	for (std::size_t t = 0; t < submitters; ++t) {
+		threads.emplace_back([&, t] () {
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::size_t single = (t * iterations + i) * 2;
+				std::size_t multi  = single + 1;
+				client.sendCommand(ReadInt32Var{3}, 1s, [&, single] (Result<std::int32_t> result) {
+					if (!result || *result != 33) ++failures;
+					++calls[single];
+				});
+				client.sendCommands(std::make_tuple(ReadInt32Var{3}, ReadInt16Var{1}), 1s, [&, multi] (MultiCommandResult<std::tuple<ReadInt32Var, ReadInt16Var>> result) {
+					if (!result || std::get<0>(*result) != 33 || std::get<1>(*result) != 11) ++failures;
+					++calls[multi];
+				});
+
+				// Wait for the callbacks, so the commands of all threads never exhaust the request IDs.
+				auto deadline = std::chrono::steady_clock::now() + 5s;
+				while ((calls[single] == 0 || calls[multi] == 0) && std::chrono::steady_clock::now() < deadline) std::this_thread::yield();
+			}
+		});
+	}
+
+	// Meanwhile, a subscription is started and stopped from yet another thread.
+	SubscriptionOptions options;
+	options.period     = 1ms;
+	options.int32_vars = {0, 8};
+	Subscription subscription{client, options};
+	std::thread subscriber{[&] () {
+		for (int i = 0; i < 10; ++i) {
+			subscription.start();
+			std::this_thread::sleep_for(2ms);
+			subscription.stop();
+		}
+	}};
+
+	for (std::thread & thread : threads) thread.join();
+	subscriber.join();
+
+	// Anything posted now runs after the last stop of the subscription.
+	std::promise<std::size_t> ids_in_use;
+	asio::post(client.get_executor(), [&] () { ids_in_use.set_value(client.idsInUse()); });
+	std::size_t ids = ids_in_use.get_future().get();
+
+	work.reset();
+	ios.stop();
+	for (std::thread & thread : io_threads) thread.join();
+
+	ASSERT_EQ(failures.load(), 0);
+	for (std::size_t i = 0; i < calls.size(); ++i) ASSERT_EQ(calls[i].load(), 1) << "callback " << i;
+	ASSERT_EQ(ids, 0u);
+}
+
+TEST_F(MockServerTest, coalescedCommands) {
+	startServer();
+
+	// Writes are gathered into coalesced requests, the odd B variable is written on its own.
+	ASSERT_TRUE(executeAll(
+		WriteUint8Var{10, 1}, WriteUint8Var{11, 2}, WriteUint8Var{12, 3},
+		WriteInt16Var{0, -1}, WriteInt16Var{1, -2},
+		WriteInt32Var{5, 50}, WriteInt32Var{7, 70}
+	));
+	ASSERT_EQ(server->variable<std::uint8_t>(10), 1);
+	ASSERT_EQ(server->variable<std::uint8_t>(11), 2);
+	ASSERT_EQ(server->variable<std::uint8_t>(12), 3);
+	ASSERT_EQ(server->variable<std::int16_t>(0), -1);
+	ASSERT_EQ(server->variable<std::int16_t>(1), -2);
+	ASSERT_EQ(server->variable<std::int32_t>(5), 50);
+	ASSERT_EQ(server->variable<std::int32_t>(7), 70);
+
+	// Results of coalesced reads are scattered back to the slots of the original commands.
+	server->setVariable<std::int32_t>(6, 60);
+	auto result = executeAll(
+		ReadUint8Var{10}, ReadUint8Var{11}, ReadUint8Var{12},
+		ReadInt32Var{5}, ReadInt32Var{6}, ReadInt32Var{7},
+		ReadStatus{},
+		ReadInt16Var{1}, ReadInt16Var{0},
+		ReadInt32Var{6}
+	);
+	ASSERT_TRUE(result);
+	ASSERT_EQ(std::get<0>(*result), 1);
+	ASSERT_EQ(std::get<1>(*result), 2);
+	ASSERT_EQ(std::get<2>(*result), 3);
+	ASSERT_EQ(std::get<3>(*result), 50);
+	ASSERT_EQ(std::get<4>(*result), 60);
+	ASSERT_EQ(std::get<5>(*result), 70);
+	ASSERT_EQ(std::get<7>(*result), -2);
+	ASSERT_EQ(std::get<8>(*result), -1);
+	ASSERT_EQ(std::get<9>(*result), 60);
+}
+
+TEST_F(MockServerTest, preparedCommands) {
+	startServer();
+
+	PreparedCommand<WriteInt32Var> write{WriteInt32Var{9, 1}};
+	PreparedCommand<ReadInt32Var> read{ReadInt32Var{9}};
+
+	for (std::int32_t value : {1, -5, 1000000}) {
+		write.setValue(value);
+		ASSERT_TRUE(execute(write));
+		ASSERT_EQ(server->variable<std::int32_t>(9), value);
+		ASSERT_EQ(*execute(read), value);
+	}
+
+	std::array<float, 2> values;
+	server->setVariable<float>(0, 0.5f);
+	server->setVariable<float>(1, 1.5f);
+	PreparedCommand<ReadFloat32VarsInto> read_into{ReadFloat32VarsInto{0, {values.data(), values.size()}}};
+	ASSERT_TRUE(execute(read_into));
+	ASSERT_EQ(values, (std::array<float, 2>{{0.5f, 1.5f}}));
+}
+
+TEST_F(MockServerTest, readRetransmit) {
+	MockServerOptions options;
+	options.request_loss  = 0.2;
+	options.response_loss = 0.2;
+	startServer(options);
+	server->setVariable<std::int32_t>(4, 44);
+
+	RetransmitOptions retransmit;
+	retransmit.max_retries     = 10;
+	retransmit.initial_timeout = 20ms;
+	retransmit.max_timeout     = 100ms;
+	client.setReadRetransmit(retransmit);
+
+	// Without retransmissions, about a third of the reads would time out.
+	for (int i = 0; i < 50; ++i) {
+		Result<std::int32_t> result = execute(ReadInt32Var{4});
+		ASSERT_TRUE(result) << result.error().format();
+		ASSERT_EQ(*result, 44);
+	}
+	ASSERT_GT(server->statistics().requests_dropped, 0u);
+	ASSERT_GT(client.statistics().retransmissions, 0u);
+}
+
+TEST_F(MockServerTest, readRetransmitMultiCommand) {
+	MockServerOptions options;
+	options.request_loss  = 0.2;
+	options.response_loss = 0.2;
+	startServer(options);
+	server->setVariable<std::int32_t>(4, 44);
+	server->setVariable<std::int32_t>(5, 55);
+	server->setVariable<std::int16_t>(0, -1);
+
+	RetransmitOptions retransmit;
+	retransmit.max_retries     = 10;
+	retransmit.initial_timeout = 20ms;
+	retransmit.max_timeout     = 100ms;
+	client.setReadRetransmit(retransmit);
+
+	// The reads of a multi-command request are retransmitted too, including coalesced reads.
+	for (int i = 0; i < 20; ++i) {
+		auto result = executeAll(ReadInt32Var{4}, ReadInt32Var{5}, ReadStatus{}, ReadInt16Var{0});
+		ASSERT_TRUE(result) << result.error().format();
+		ASSERT_EQ(std::get<0>(*result), 44);
+		ASSERT_EQ(std::get<1>(*result), 55);
+		ASSERT_EQ(std::get<3>(*result), -1);
+	}
+	ASSERT_GT(server->statistics().requests_dropped, 0u);
+	ASSERT_GT(client.statistics().retransmissions, 0u);
+}
+
+TEST_F(MockServerTest, statistics) {
+	startServer();
+	server->setVariable<std::int32_t>(4, 44);
+
+	for (int i = 0; i < 20; ++i) ASSERT_TRUE(execute(ReadInt32Var{4}));
+	ASSERT_TRUE(execute(ReadStatus{}));
+
+	ClientStatistics statistics = client.statistics();
+	ASSERT_EQ(statistics.messages_sent, 21u);
+	ASSERT_EQ(statistics.messages_received, 21u);
+	ASSERT_EQ(statistics.retransmissions, 0u);
+	ASSERT_EQ(statistics.timeouts, 0u);
+	ASSERT_EQ(statistics.latency.count, 21u);
+	ASSERT_GT(statistics.smoothed_rtt.count(), 0);
+	ASSERT_LE(statistics.latency.quantile(0.5), statistics.latency.max);
+	ASSERT_EQ(statistics.command_latency.size(), 2u);
+	for (auto const & [key, latency] : statistics.command_latency) {
+		ASSERT_EQ(key.division, Division::robot);
+		ASSERT_EQ(latency.count, key.command == commands::robot::readwrite_int32_variable ? 20u : 1u);
+	}
+
+	// Other threads get a snapshot through a callback on the strand.
+	std::optional<ClientStatistics> snapshot;
+	client.statistics([&] (ClientStatistics statistics) { snapshot = std::move(statistics); });
+	ASSERT_EQ(wait(snapshot).messages_sent, 21u);
+}
+
+TEST_F(MockServerTest, tracing) {
+	startServer();
+	server->setVariable<std::int32_t>(4, 44);
+
+	TraceRecorder recorder{4};
+	client.setTracer(&recorder);
+	ASSERT_TRUE(execute(ReadInt32Var{4}));
+	ASSERT_TRUE(execute(ReadInt32Var{4}));
+	client.setTracer(nullptr);
+	ios.poll();
+
+	if (!trace_enabled) {
+		ASSERT_EQ(recorder.recorded(), 0u);
+		return;
+	}
+
+	// Each command records send, receive, decode, resolve and dispatch.
+	ASSERT_EQ(recorder.recorded(), 10u);
+	std::vector<TraceRecord> records = recorder.records();
+	ASSERT_EQ(records.size(), 4u);
+	ASSERT_EQ(records[0].event, TraceEvent::receive);
+	ASSERT_EQ(records[1].event, TraceEvent::decode);
+	ASSERT_EQ(records[2].event, TraceEvent::resolve);
+	ASSERT_EQ(records[3].event, TraceEvent::dispatch);
+	for (TraceRecord const & record : records) {
+		ASSERT_EQ(record.request_id, records[0].request_id);
+		ASSERT_EQ(record.command, (CommandKey{Division::robot, commands::robot::readwrite_int32_variable}));
+		ASSERT_LE(record.start, record.end);
+	}
+
+	// Decoding and the completion callback run inside the dispatch of the response.
+	ASSERT_LE(records[0].start, records[3].start);
+	ASSERT_LE(records[3].start, records[1].start);
+	ASSERT_LE(records[2].end, records[3].end);
+
+	std::ostringstream trace;
+	recorder.writeChromeTrace(trace);
+	ASSERT_NE(trace.str().find("\"name\": \"dispatch\", \"cat\": \"robot\", \"ph\": \"X\""), std::string::npos);
+}
+
+TEST_F(MockServerTest, statusAndPosition) {
+	startServer();
+
+	Status status{};
+	status.running  = true;
+	status.servo_on = true;
+	server->setStatus(status);
+
+	Result<Status> read_status = execute(ReadStatus{});
+	ASSERT_TRUE(read_status);
+	ASSERT_TRUE(read_status->running);
+	ASSERT_TRUE(read_status->servo_on);
+	ASSERT_FALSE(read_status->alarm);
+
+	Position position = PulsePosition{std::array<int, 8>{{10, 20, 30, 40, 50, 60, 0, 0}}, 1};
+	server->setPosition(position);
+	ASSERT_EQ(*execute(ReadCurrentPosition{0, CoordinateSystemType::robot_pulse}), position);
+}
+
+TEST_F(MockServerTest, files) {
+	startServer();
+	std::string data = makeData(2000);
+
+	ASSERT_TRUE(writeFile("TEST.JBI", data));
+	ASSERT_EQ(server->file("TEST.JBI"), data);
+
+	server->setFile("OTHER.JBI", "x");
+	server->setFile("NOT_A_JOB.DAT", "y");
+	std::optional<Result<FileList>> list;
+	client.readFileList("*.JBI", 1s, [&] (Result<FileList> result) { list = std::move(result); }, nullptr);
+	Result<FileList> names = wait(list);
+	ASSERT_TRUE(names);
+	ASSERT_EQ((std::vector<std::string>{names->begin(), names->end()}), (std::vector<std::string>{"OTHER.JBI", "TEST.JBI"}));
+
+	ASSERT_EQ(*readFile("TEST.JBI"), data);
+	ASSERT_FALSE(readFile("MISSING.JBI"));
+
+	std::optional<Result<void>> deleted;
+	client.deleteFile("TEST.JBI", 1s, [&] (Result<void> result) { deleted = std::move(result); });
+	ASSERT_TRUE(wait(deleted));
+	ASSERT_EQ(server->file("TEST.JBI"), std::nullopt);
+}
+
+TEST_F(MockServerTest, readFileStreaming) {
+	startServer();
+	std::string data = makeData(5000);
+	server->setFile("STREAM.JBI", data);
+
+	std::string received;
+	std::size_t blocks = 0;
+	std::optional<Result<void>> result;
+	client.readFileStreaming("STREAM.JBI", [&] (std::string_view block) -> Result<void> {
+		received.append(block);
+		++blocks;
+		return estd::in_place_valid;
+	}, 10s, [&] (Result<void> response) { result = std::move(response); }, nullptr);
+
+	ASSERT_TRUE(wait(result));
+	ASSERT_EQ(received, data);
+	ASSERT_EQ(blocks, (data.size() + max_payload_size - 1) / max_payload_size);
+}
+
+TEST_F(MockServerTest, readFileStreamingSinkError) {
+	startServer();
+	server->setFile("STREAM.JBI", makeData(5000));
+
+	// The download is aborted with the error of the sink, and the sink is not called again.
+	std::size_t blocks = 0;
+	std::optional<Result<void>> result;
+	client.readFileStreaming("STREAM.JBI", [&] (std::string_view) -> Result<void> {
+		if (++blocks == 2) return Error{std::errc::no_space_on_device, "writing block"};
+		return estd::in_place_valid;
+	}, 10s, [&] (Result<void> response) { result = std::move(response); }, nullptr);
+
+	Result<void> response = wait(result);
+	ASSERT_FALSE(response);
+	ASSERT_EQ(response.error().code, std::errc::no_space_on_device);
+	ASSERT_EQ(blocks, 2u);
+}
+
+TEST_F(MockServerTest, readFileStreamingToFd) {
+	startServer();
+	std::string data = makeData(3000);
+	server->setFile("STREAM.JBI", data);
+
+	std::FILE * file = std::tmpfile();
+	ASSERT_NE(file, nullptr);
+	std::optional<Result<void>> result;
+	client.readFileStreaming("STREAM.JBI", ::fileno(file), 10s, [&] (Result<void> response) { result = std::move(response); }, nullptr);
+	ASSERT_TRUE(wait(result));
+
+	std::string written(data.size() + 1, '\0');
+	ASSERT_EQ(::pread(::fileno(file), written.data(), written.size(), 0), ssize_t(data.size()));
+	written.resize(data.size());
+	ASSERT_EQ(written, data);
+	std::fclose(file);
+}
+
+TEST_F(MockServerTest, writeFileFromFd) {
+	startServer();
+	std::string data = makeData(3000);
+
+	std::FILE * file = std::tmpfile();
+	ASSERT_NE(file, nullptr);
+	ASSERT_EQ(::write(::fileno(file), data.data(), data.size()), ssize_t(data.size()));
+
+	// A regular file at offset 0 is mapped.
+	ASSERT_EQ(::lseek(::fileno(file), 0, SEEK_SET), 0);
+	std::optional<Result<void>> result;
+	client.writeFile("MAPPED.JBI", ::fileno(file), 10s, [&] (Result<void> response) { result = std::move(response); }, nullptr);
+	ASSERT_TRUE(wait(result));
+	ASSERT_EQ(server->file("MAPPED.JBI"), data);
+
+	// At another offset the rest of the file is mapped.
+	ASSERT_EQ(::lseek(::fileno(file), 1000, SEEK_SET), 1000);
+	result.reset();
+	client.writeFile("OFFSET.JBI", ::fileno(file), 10s, [&] (Result<void> response) { result = std::move(response); }, nullptr);
+	ASSERT_TRUE(wait(result));
+	ASSERT_EQ(server->file("OFFSET.JBI"), data.substr(1000));
+	std::fclose(file);
+
+	// A pipe can not be mapped and is read until the end.
+	int pipe[2];
+	ASSERT_EQ(::pipe(pipe), 0);
+	ASSERT_EQ(::write(pipe[1], data.data(), data.size()), ssize_t(data.size()));
+	::close(pipe[1]);
+	result.reset();
+	client.writeFile("PIPE.JBI", pipe[0], 10s, [&] (Result<void> response) { result = std::move(response); }, nullptr);
+	::close(pipe[0]);
+	ASSERT_TRUE(wait(result));
+	ASSERT_EQ(server->file("PIPE.JBI"), data);
+}
+
+TEST_F(MockServerTest, readFileLostLastAck) {
+	MockServerOptions options;
+	options.file_retransmit_interval = 20ms;
+	options.drop_last_block_acks     = 2;
+	startServer(options);
+	client.on_error = [] (Error error) { ADD_FAILURE() << error.format(); };
+
+	std::string data = makeData(3000);
+	server->setFile("LAST.JBI", data);
+	Result<std::string> result = readFile("LAST.JBI");
+	ASSERT_TRUE(result) << result.error().format();
+	ASSERT_EQ(*result, data);
+
+	// The server sends the last block again until it sees an ack, which the finished session still gives.
+	runFor(200ms);
+	ASSERT_EQ(server->statistics().downloads_completed, 1u);
+	ASSERT_GE(server->statistics().file_retransmits, 2u);
+	ASSERT_EQ(client.statistics().unexpected_responses, 0u);
+}
+
+TEST_F(MockServerTest, fileTransferManagerSessionLimit) {
+	startServer();
+
+	FileTransferOptions options;
+	options.max_sessions = 3;
+	FileTransferManager manager{client, options};
+
+	// Progress is reported from the strand of the client, so the manager can be inspected there.
+	std::size_t max_active = 0;
+	std::optional<bool> idle;
+	manager.on_progress = [&] (std::size_t, std::size_t, std::size_t) { max_active = std::max(max_active, manager.activeTransfers()); };
+	manager.on_idle     = [&] () { idle = true; };
+
+	std::vector<std::string> data;
+	std::size_t done = 0;
+	for (int i = 0; i < 8; ++i) {
+		data.push_back(makeData(3000 + i));
+		manager.upload("FILE" + std::to_string(i) + ".JBI", data.back(), [&] (Result<void> result) {
+			ASSERT_TRUE(result) << result.error().format();
+			++done;
+		});
+	}
+
+	ASSERT_TRUE(wait(idle));
+	ASSERT_EQ(done, 8u);
+	ASSERT_EQ(max_active, 3u);
+	for (int i = 0; i < 8; ++i) ASSERT_EQ(server->file("FILE" + std::to_string(i) + ".JBI"), data[i]);
+}
+
+TEST_F(MockServerTest, fileTransferManagerByteBudget) {
+	startServer();
+
+	FileTransferOptions options;
+	options.max_sessions        = 4;
+	options.max_bytes_in_flight = 7000;
+	FileTransferManager manager{client, options};
+
+	// Only two small files fit in the budget, and the large file has to run on its own.
+	std::size_t max_active = 0;
+	std::size_t max_bytes  = 0;
+	bool over_budget_shared = false;
+	std::optional<bool> idle;
+	manager.on_progress = [&] (std::size_t, std::size_t, std::size_t) {
+		max_active = std::max(max_active, manager.activeTransfers());
+		if (manager.bytesInFlight() > options.max_bytes_in_flight) {
+			over_budget_shared |= manager.activeTransfers() != 1;
+		} else {
+			max_bytes = std::max(max_bytes, manager.bytesInFlight());
+		}
+	};
+	manager.on_idle = [&] () { idle = true; };
+
+	std::size_t done = 0;
+	auto on_done = [&] (Result<void> result) {
+		ASSERT_TRUE(result) << result.error().format();
+		++done;
+	};
+	for (int i = 0; i < 4; ++i) manager.upload("SMALL" + std::to_string(i) + ".JBI", makeData(3000), on_done);
+	std::string large = makeData(10000);
+	manager.upload("LARGE.JBI", large, on_done);
+
+	ASSERT_TRUE(wait(idle));
+	ASSERT_EQ(done, 5u);
+	ASSERT_EQ(max_active, 2u);
+	ASSERT_EQ(max_bytes, 6000u);
+	ASSERT_FALSE(over_budget_shared);
+	ASSERT_EQ(server->file("LARGE.JBI"), large);
+}
+
+TEST_F(MockServerTest, fileTransferManagerRejectsPipe) {
+	startServer();
+	FileTransferManager manager{client};
+
+	// A pipe would have to be read on the strand of the client, so it is refused.
+	int pipe[2];
+	ASSERT_EQ(::pipe(pipe), 0);
+	std::optional<Result<void>> result;
+	manager.upload("PIPE.JBI", pipe[0], [&] (Result<void> response) { result = std::move(response); });
+	Result<void> response = wait(result);
+	::close(pipe[0]);
+	::close(pipe[1]);
+	ASSERT_FALSE(response);
+	ASSERT_EQ(response.error().code, std::errc::invalid_argument);
+	ASSERT_EQ(manager.activeTransfers(), 0u);
+}
+
+TEST_F(MockServerTest, filesWithImpairments) {
+	MockServerOptions options;
+	options.latency       = 200us;
+	options.jitter        = 100us;
+	options.request_loss  = 0.1;
+	options.response_loss = 0.1;
+	options.reorder       = 0.1;
+	startServer(options);
+	std::string data = makeData(5000);
+
+	ASSERT_TRUE(writeFile("LOSSY.JBI", data));
+	ASSERT_EQ(server->file("LOSSY.JBI"), data);
+	ASSERT_EQ(*readFile("LOSSY.JBI"), data);
+
+	MockServer::Statistics statistics = server->statistics();
+	ASSERT_GT(statistics.requests_dropped, 0u);
+	ASSERT_GT(statistics.responses_dropped, 0u);
+}
+
+TEST_F(MockServerTest, subscription) {
+	startServer();
+	for (int i = 0; i < 150; ++i) server->setVariable<std::int32_t>(i, i * 10);
+	for (int i = 1; i < 256; ++i) server->setVariable<std::uint8_t>(i, i);
+	Position position = PulsePosition{std::array<int, 8>{{1, 2, 3, 4, 5, 6, 7, 8}}};
+	server->setVariable<Position>(2, position);
+
+	SubscriptionOptions options;
+	options.period        = 10ms;
+	options.status        = true;
+	options.uint8_vars    = {1, 255};
+	options.int32_vars    = {0, 150};
+	options.position_vars = {1, 2};
+
+	Subscription subscription{client, options};
+	std::size_t changes = 0;
+	std::optional<SubscriptionSnapshot> snapshot;
+	subscription.on_change = [&] (SubscriptionSnapshot const & data) {
+		++changes;
+		snapshot = data;
+	};
+	subscription.on_error = [&] (Error error) {
+		ADD_FAILURE() << error.format();
+	};
+	subscription.start();
+
+	// The first cycle is always published.
+	SubscriptionSnapshot first = wait(snapshot);
+	snapshot.reset();
+	// The 255 B variables need an even sized chunk and a padded odd remainder.
+	ASSERT_EQ(first.uint8_vars.size(), 255u);
+	for (int i = 0; i < 255; ++i) ASSERT_EQ(first.uint8_vars[i], i + 1);
+	ASSERT_EQ(first.int32_vars.size(), 150u);
+	ASSERT_EQ(first.int32_vars[0], 0);
+	ASSERT_EQ(first.int32_vars[149], 1490);
+	ASSERT_EQ(first.position_vars.size(), 2u);
+	ASSERT_EQ(first.position_vars[1], position);
+
+	// Unchanged values are not published again.
+	while (subscription.cycles() < first.cycle + 10 && ios.run_one()) {}
+	ASSERT_EQ(changes, 1u);
+
+	// Changed values are.
+	server->setVariable<std::int32_t>(120, -1);
+	SubscriptionSnapshot second = wait(snapshot);
+	ASSERT_GT(second.cycle, first.cycle);
+	ASSERT_EQ(second.int32_vars[120], -1);
+	ASSERT_EQ(changes, 2u);
+
+	// Stopping releases the request IDs.
+	subscription.stop();
+	ios.poll();
+	ASSERT_EQ(client.idsInUse(), 0u);
+}
+
+TEST_F(MockServerTest, subscriptionStopFromErrorHandler) {
+	MockServerOptions server_options;
+	server_options.response_loss = 1.0;
+	startServer(server_options);
+
+	SubscriptionOptions options;
+	options.period     = 5ms;
+	options.status     = true;
+	options.int32_vars = {0, 4};
+
+	Subscription subscription{client, options};
+	std::size_t errors = 0;
+	subscription.on_error = [&] (Error) {
+		++errors;
+		subscription.stop();
+	};
+	subscription.on_change = [&] (SubscriptionSnapshot const &) {
+		ADD_FAILURE() << "no responses should arrive";
+	};
+	subscription.start();
+
+	// The second cycle reports the missing responses of the first one, and the handler stops the subscription.
+	while (errors == 0 && ios.run_one()) {}
+	ASSERT_EQ(client.idsInUse(), 0u);
+
+	// The cycle that reported the error must not send anything after the stop.
+	runFor(50ms);
+	ASSERT_EQ(errors, 1u);
+	ASSERT_EQ(client.idsInUse(), 0u);
+	ASSERT_EQ(server->statistics().requests_received, 2u);
+}
+
+TEST_F(MockServerTest, subscriptionLossIsNotRetransmission) {
+	MockServerOptions server_options;
+	server_options.response_loss = 0.3;
+	startServer(server_options);
+
+	SubscriptionOptions options;
+	options.period = 5ms;
+	options.status = true;
+
+	Subscription subscription{client, options};
+	subscription.start();
+	runFor(200ms);
+	subscription.stop();
+	ios.poll();
+
+	// Every cycle is a new request, even though it re-uses the request ID of the lost one.
+	ASSERT_GT(server->statistics().responses_dropped, 0u);
+	ASSERT_GT(subscription.missedCycles(), 0u);
+	ASSERT_EQ(client.statistics().retransmissions, 0u);
+}
+
+TEST_F(MockServerTest, rpcServerRestartWithMoreServices) {
+	startServer();
+
+	std::vector<int> calls;
+	auto service = [&calls] (int index) {
+		return [&calls, index] (std::function<void(Error)> resolve) {
+			calls.push_back(index);
+			resolve({});
+		};
+	};
+
+	// Poll without delay, so there is never a timer pending after a stop.
+	RpcServer rpc{client, 10, 0ms, [] (Error error) { ADD_FAILURE() << error.format(); }};
+	auto stop = [&] () {
+		ASSERT_TRUE(rpc.stop());
+		while (client.idsInUse() > 0 && ios.run_one()) {}
+	};
+
+	rpc.addService("zero", service(0));
+	ASSERT_TRUE(rpc.start());
+	server->setVariable<std::uint8_t>(10, service_status::requested);
+	while (calls.size() < 1 && ios.run_one()) {}
+	stop();
+
+	// Services added after the first start are polled after the next start.
+	rpc.addService("one", service(1));
+	rpc.addService("two", service(2));
+	ASSERT_TRUE(rpc.start());
+	server->setVariable<std::uint8_t>(12, service_status::requested);
+	while (calls.size() < 2 && ios.run_one()) {}
+	stop();
+
+	ASSERT_EQ(calls, (std::vector<int>{0, 2}));
+	ASSERT_EQ(server->variable<std::uint8_t>(10), service_status::idle);
+	ASSERT_EQ(server->variable<std::uint8_t>(12), service_status::idle);
+}
+
+}}}
@@ -0,0 +1,160 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "udp/client.hpp"
+#include <gtest/gtest.h>
+
+#include <asio/io_service.hpp>
+
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+/// Fixture with an unconnected client, the request ID functions are used directly.
+class RequestIdTest : public testing::Test {
+protected:
+	asio::io_service ios;
+	Client client{ios};
+
+	/// Allocate all request IDs one by one.
+	void allocateAll() {
+		for (int i = 0; i < 256; ++i) ASSERT_TRUE(client.allocateId());
+		ASSERT_EQ(client.idsInUse(), 256u);
+	}
+};
+
+TEST_F(RequestIdTest, roundRobin) {
+	ASSERT_EQ(*client.allocateId(), 1);
+	ASSERT_EQ(*client.allocateId(), 2);
+	ASSERT_EQ(*client.allocateId(), 3);
+
+	// Released IDs are not handed out again right away.
+	client.releaseId(2);
+	ASSERT_EQ(*client.allocateId(), 4);
+	ASSERT_EQ(client.idsInUse(), 4u);
+}
+
+TEST_F(RequestIdTest, exhaustion) {
+	allocateAll();
+
+	Result<std::uint8_t> id = client.allocateId();
+	ASSERT_FALSE(id);
+	ASSERT_EQ(id.error().code, errc::no_free_request_id);
+
+	client.releaseId(7);
+	ASSERT_EQ(client.idsInUse(), 255u);
+	ASSERT_EQ(*client.allocateId(), 7);
+}
+
+TEST_F(RequestIdTest, wrapAround) {
+	// Advance the round-robin position to 255.
+	for (int i = 1; i < 255; ++i) ASSERT_EQ(*client.allocateId(), i);
+	for (int i = 1; i < 255; ++i) client.releaseId(i);
+	ASSERT_EQ(client.idsInUse(), 0u);
+
+	ASSERT_EQ(*client.allocateId(), 255);
+	ASSERT_EQ(*client.allocateId(), 0);
+	ASSERT_EQ(*client.allocateId(), 1);
+}
+
+TEST_F(RequestIdTest, rangeAcrossWrapAround) {
+	for (int i = 1; i < 255; ++i) ASSERT_TRUE(client.allocateId());
+	for (int i = 1; i < 255; ++i) client.releaseId(i);
+
+	// The range 255, 0, 1, 2 wraps around.
+	ASSERT_EQ(*client.allocateIds(4), 255);
+	ASSERT_EQ(client.idsInUse(), 4u);
+	ASSERT_EQ(*client.allocateId(), 3);
+
+	for (int id : {255, 0, 1, 2}) client.releaseId(id);
+	ASSERT_EQ(client.idsInUse(), 1u);
+}
+
+TEST_F(RequestIdTest, rangeSkipsAllocatedIds) {
+	allocateAll();
+	for (int id : {10, 11, 12, 20, 21}) client.releaseId(id);
+
+	ASSERT_EQ(*client.allocateIds(3), 10);
+	ASSERT_EQ(*client.allocateIds(2), 20);
+
+	Result<std::uint8_t> id = client.allocateId();
+	ASSERT_FALSE(id);
+	ASSERT_EQ(id.error().code, errc::no_free_request_id);
+}
+
+TEST_F(RequestIdTest, noContiguousRange) {
+	allocateAll();
+	for (int id : {10, 11, 20}) client.releaseId(id);
+
+	// Enough IDs are free, but not next to each other.
+	Result<std::uint8_t> id = client.allocateIds(3);
+	ASSERT_FALSE(id);
+	ASSERT_EQ(id.error().code, errc::no_free_request_id);
+	ASSERT_EQ(client.idsInUse(), 253u);
+
+	ASSERT_EQ(*client.allocateIds(2), 10);
+	ASSERT_EQ(*client.allocateIds(1), 20);
+}
+
+TEST_F(RequestIdTest, releaseUnallocatedIdDoesNothing) {
+	ASSERT_EQ(*client.allocateId(), 1);
+	client.releaseId(1);
+	client.releaseId(1);
+	client.releaseId(100);
+	ASSERT_EQ(client.idsInUse(), 0u);
+}
+
+TEST_F(RequestIdTest, handlers) {
+	auto handler = [] (ResponseHeader const &, std::string_view) {};
+
+	// Registering a handler allocates the ID if needed.
+	Client::HandlerToken token = client.registerHandler(5, handler);
+	ASSERT_EQ(client.idsInUse(), 1u);
+	ASSERT_THROW(client.registerHandler(5, handler), std::logic_error);
+	ASSERT_THROW(client.releaseId(5), std::logic_error);
+
+	// Removing the handler releases the ID.
+	client.removeHandler(token);
+	ASSERT_EQ(client.idsInUse(), 0u);
+
+	// An allocated ID is not allocated twice when a handler is registered for it.
+	std::uint8_t id = *client.allocateId();
+	client.removeHandler(client.registerHandler(id, handler));
+	ASSERT_EQ(client.idsInUse(), 0u);
+}
+
+}}}
@@ -0,0 +1,166 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "udp/impl/session_pool.hpp"
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+int main(int argc, char ** argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+namespace impl {
+
+/// The largest allocation that is still served from the free lists.
+constexpr std::size_t max_pooled_size = 64 * 32;
+
+TEST(SessionPool, reusesFreedBlock) {
+	SessionPool pool;
+	void * block = pool.allocate(100);
+	std::memset(block, 0xaa, 100);
+	pool.deallocate(block, 100);
+
+	// Any size in the same size class gets the same block back.
+	void * again = pool.allocate(128);
+	ASSERT_EQ(again, block);
+	pool.deallocate(again, 128);
+}
+
+TEST(SessionPool, separateSizeClasses) {
+	SessionPool pool;
+	void * small = pool.allocate(10);
+	pool.deallocate(small, 10);
+
+	// The small block is still on its free list, so a larger allocation can not get it.
+	void * large = pool.allocate(100);
+	ASSERT_NE(large, small);
+	ASSERT_EQ(pool.allocate(1), small);
+	pool.deallocate(large, 100);
+	pool.deallocate(small, 1);
+}
+
+TEST(SessionPool, freeListIsLifo) {
+	SessionPool pool;
+	void * a = pool.allocate(64);
+	void * b = pool.allocate(64);
+	pool.deallocate(a, 64);
+	pool.deallocate(b, 64);
+	ASSERT_EQ(pool.allocate(64), b);
+	ASSERT_EQ(pool.allocate(64), a);
+	pool.deallocate(a, 64);
+	pool.deallocate(b, 64);
+}
+
+TEST(SessionPool, oversizeBypassesPool) {
+	SessionPool pool;
+	void * pooled = pool.allocate(max_pooled_size);
+	pool.deallocate(pooled, max_pooled_size);
+
+	// The pooled block is on a free list, so it can not be handed out for an oversized allocation.
+	void * oversize = pool.allocate(max_pooled_size + 1);
+	ASSERT_NE(oversize, pooled);
+	std::memset(oversize, 0xaa, max_pooled_size + 1);
+	pool.deallocate(oversize, max_pooled_size + 1);
+
+	// And the freed oversized block did not end up on a free list.
+	ASSERT_EQ(pool.allocate(max_pooled_size), pooled);
+	pool.deallocate(pooled, max_pooled_size);
+}
+
+TEST(SessionPool, reusesBuffers) {
+	SessionPool pool;
+	std::vector<std::uint8_t> buffer = pool.acquireBuffer();
+	ASSERT_TRUE(buffer.empty());
+	ASSERT_GE(buffer.capacity(), header_size + max_payload_size);
+
+	buffer.resize(10, 0xaa);
+	std::uint8_t const * data = buffer.data();
+	pool.releaseBuffer(std::move(buffer));
+
+	std::vector<std::uint8_t> again = pool.acquireBuffer();
+	ASSERT_EQ(again.data(), data);
+	ASSERT_TRUE(again.empty());
+}
+
+TEST(SessionPool, concurrentAllocations) {
+	SessionPool pool;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t) {
+		threads.emplace_back([&pool, t] () {
+			for (int i = 0; i < 10000; ++i) {
+				std::size_t size = 1 + (i * 37 + t) % (2 * max_pooled_size);
+				void * block = pool.allocate(size);
+				std::memset(block, t, size);
+				pool.deallocate(block, size);
+			}
+		});
+	}
+	for (std::thread & thread : threads) thread.join();
+}
+
+TEST(PoolAllocator, reusesMemoryOfSharedObjects) {
+	auto pool = std::make_shared<SessionPool>();
+	struct Session { char data[200]; };
+
+	auto first = std::allocate_shared<Session>(PoolAllocator<Session>{pool});
+	void * address = first.get();
+	first.reset();
+
+	auto second = std::allocate_shared<Session>(PoolAllocator<Session>{pool});
+	ASSERT_EQ(second.get(), address);
+}
+
+TEST(PoolAllocator, keepsPoolAlive) {
+	auto pool = std::make_shared<SessionPool>();
+	std::weak_ptr<SessionPool> weak = pool;
+	auto object = std::allocate_shared<int>(PoolAllocator<int>{std::move(pool)}, 42);
+	ASSERT_FALSE(weak.expired());
+	object.reset();
+	ASSERT_TRUE(weak.expired());
+}
+
+TEST(PoolAllocator, equality) {
+	auto pool  = std::make_shared<SessionPool>();
+	auto other = std::make_shared<SessionPool>();
+	PoolAllocator<int> a{pool};
+	PoolAllocator<double> b{a};
+	ASSERT_TRUE(a == b);
+	ASSERT_FALSE(a != b);
+	ASSERT_TRUE(a != PoolAllocator<int>{other});
+}
+
+}}}}
@@ -0,0 +1,90 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "../mock/mock_server.hpp"
+
+#include <asio/io_service.hpp>
+#include <asio/ip/address.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace dr::yaskawa;
+
+void usage(char const * name) {
+	std::cerr
+		<< "usage: " << name << " [options]\n\n"
+		<< "options:\n"
+		<< "\t--address ADDRESS   address to listen on (default 127.0.0.1)\n"
+		<< "\t--port PORT         port to listen on (default 10040)\n"
+		<< "\t--latency US        delay of each response in microseconds\n"
+		<< "\t--jitter US         maximum random extra delay in microseconds\n"
+		<< "\t--loss P            probability to drop a request and a response\n"
+		<< "\t--reorder P         probability to hold back a response\n"
+		<< "\t--seed N            seed for the random number generator\n";
+}
+
+int main(int argc, char * * argv) {
+	std::string address = "127.0.0.1";
+	unsigned short port = 10040;
+	udp::MockServerOptions options;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string option = argv[i];
+		if (option == "-h" || option == "--help") {
+			usage(argv[0]);
+			return 0;
+		}
+		if (i + 1 >= argc) {
+			std::cerr << "missing value for option " << option << "\n";
+			return 1;
+		}
+		char const * value = argv[++i];
+		if      (option == "--address") address = value;
+		else if (option == "--port")    port = std::atoi(value);
+		else if (option == "--latency") options.latency = std::chrono::microseconds{std::atol(value)};
+		else if (option == "--jitter")  options.jitter  = std::chrono::microseconds{std::atol(value)};
+		else if (option == "--loss")    options.request_loss = options.response_loss = std::atof(value);
+		else if (option == "--reorder") options.reorder = std::atof(value);
+		else if (option == "--seed")    options.seed    = std::atol(value);
+		else {
+			std::cerr << "unknown option: " << option << "\n";
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	asio::io_service ios;
+	udp::MockServer server{ios, options, {asio::ip::make_address(address), port}};
+	server.start();
+
+	std::cerr << "Mock controller listening on " << server.endpoint() << "\n";
+	ios.run();
+}
@@ -27,113 +27,116 @@
  */
 
 #include "udp/client.hpp"
+#include "udp/subscription.hpp"
 
 #include <asio/io_service.hpp>
-#include <asio/steady_timer.hpp>
 
 #include <chrono>
 #include <iostream>
 #include <iomanip>
+#include <memory>
 
 using namespace std::chrono_literals;
 using namespace dr::yaskawa;
 
 std::chrono::milliseconds timeout = 200ms;
 
-void readPosition(udp::Client & client);
-void readStatus(udp::Client & client);
+/// Time between two polls of the status and position.
+std::chrono::milliseconds poll_period = 100ms;
 
-void readPosition(udp::Client & client) {
-	client.sendCommand(ReadCurrentPosition{0, CoordinateSystemType::robot_cartesian}, timeout, [&client] (Result<Position> const & result) {
-		if (!result) {
-			std::cout << "Error reading current position: " << result.error().format() << "\n";
-			client.close();
-			return;
-		}
-
-		if (result->isPulse()) {
-			auto position = result->cartesian();
-			std::cout
-				<< "position: !pulse\n"
-				<< "  tool:   " << position.tool()  << "\n"
-				<< "  joints: [\n"
-				   "    " << position[0] << ",\n"
-				   "    " << position[1] << ",\n"
-				   "    " << position[2] << ",\n"
-				   "    " << position[3] << ",\n"
-				   "    " << position[4] << ",\n"
-				   "    " << position[5] << ",\n"
-				   "    " << position[6] << ",\n"
-				   "    " << position[7] << ",\n"
-				   "  ]\n";
-				;
-		}
-
-		if (result->isCartesian()) {
-			auto position = result->cartesian();
-			std::cout
-				<< "position: !cartesian\n"
-				<< "  x:      " << std::fixed << std::setprecision(3) << position.x()  << "\n"
-				<< "  y:      " << std::fixed << std::setprecision(3) << position.y()  << "\n"
-				<< "  z:      " << std::fixed << std::setprecision(3) << position.z()  << "\n"
-				<< "  rx:     " << std::fixed << std::setprecision(4) << position.rx() << "\n"
-				<< "  ry:     " << std::fixed << std::setprecision(4) << position.ry() << "\n"
-				<< "  rz:     " << std::fixed << std::setprecision(4) << position.rz() << "\n"
-				<< "  frame:  " << position.frame()          << "\n"
-				<< "  tool:   " << position.tool()           << "\n"
-				<< "  config: " << position.configuration()  << "\n"
-				;
-		}
-
-		readStatus(client);
-	});
-}
+void printPosition(Position const & result) {
+	if (result.isPulse()) {
+		auto position = result.cartesian();
+		std::cout
+			<< "position: !pulse\n"
+			<< "  tool:   " << position.tool()  << "\n"
+			<< "  joints: [\n"
+			   "    " << position[0] << ",\n"
+			   "    " << position[1] << ",\n"
+			   "    " << position[2] << ",\n"
+			   "    " << position[3] << ",\n"
+			   "    " << position[4] << ",\n"
+			   "    " << position[5] << ",\n"
+			   "    " << position[6] << ",\n"
+			   "    " << position[7] << ",\n"
+			   "  ]\n";
+			;
+	}
 
-void readStatus(udp::Client & client) {
-	client.sendCommand(ReadStatus{}, timeout, [&client] (Result<dr::yaskawa::Status> const & result) {
-		if (!result) {
-			std::cout << "Error reading status: " << result.error().format() << "\n";
-			client.close();
-			return;
-		}
+	if (result.isCartesian()) {
+		auto position = result.cartesian();
 		std::cout
-			<< "---\n"
-			<< "status:\n"
-			<< "  step:               " << (result->step               ? "true" : "false") << "\n"
-			<< "  one_cycle:          " << (result->one_cycle          ? "true" : "false") << "\n"
-			<< "  continuous:         " << (result->continuous         ? "true" : "false") << "\n"
-			<< "  running:            " << (result->running            ? "true" : "false") << "\n"
-			<< "  speed_limited:      " << (result->speed_limited      ? "true" : "false") << "\n"
-			<< "  teach:              " << (result->teach              ? "true" : "false") << "\n"
-			<< "  play:               " << (result->play               ? "true" : "false") << "\n"
-			<< "  remote:             " << (result->remote             ? "true" : "false") << "\n"
-			<< "  teach_pendant_hold: " << (result->teach_pendant_hold ? "true" : "false") << "\n"
-			<< "  external_hold:      " << (result->external_hold      ? "true" : "false") << "\n"
-			<< "  command_hold:       " << (result->command_hold       ? "true" : "false") << "\n"
-			<< "  alarm:              " << (result->alarm              ? "true" : "false") << "\n"
-			<< "  error:              " << (result->error              ? "true" : "false") << "\n"
-			<< "  servo_on:           " << (result->servo_on           ? "true" : "false") << "\n"
+			<< "position: !cartesian\n"
+			<< "  x:      " << std::fixed << std::setprecision(3) << position.x()  << "\n"
+			<< "  y:      " << std::fixed << std::setprecision(3) << position.y()  << "\n"
+			<< "  z:      " << std::fixed << std::setprecision(3) << position.z()  << "\n"
+			<< "  rx:     " << std::fixed << std::setprecision(4) << position.rx() << "\n"
+			<< "  ry:     " << std::fixed << std::setprecision(4) << position.ry() << "\n"
+			<< "  rz:     " << std::fixed << std::setprecision(4) << position.rz() << "\n"
+			<< "  frame:  " << position.frame()          << "\n"
+			<< "  tool:   " << position.tool()           << "\n"
+			<< "  config: " << position.configuration()  << "\n"
 			;
+	}
+}
 
-		readPosition(client);
-	});
+void printStatus(dr::yaskawa::Status const & result) {
+	std::cout
+		<< "---\n"
+		<< "status:\n"
+		<< "  step:               " << (result.step               ? "true" : "false") << "\n"
+		<< "  one_cycle:          " << (result.one_cycle          ? "true" : "false") << "\n"
+		<< "  continuous:         " << (result.continuous         ? "true" : "false") << "\n"
+		<< "  running:            " << (result.running            ? "true" : "false") << "\n"
+		<< "  speed_limited:      " << (result.speed_limited      ? "true" : "false") << "\n"
+		<< "  teach:              " << (result.teach              ? "true" : "false") << "\n"
+		<< "  play:               " << (result.play               ? "true" : "false") << "\n"
+		<< "  remote:             " << (result.remote             ? "true" : "false") << "\n"
+		<< "  teach_pendant_hold: " << (result.teach_pendant_hold ? "true" : "false") << "\n"
+		<< "  external_hold:      " << (result.external_hold      ? "true" : "false") << "\n"
+		<< "  command_hold:       " << (result.command_hold       ? "true" : "false") << "\n"
+		<< "  alarm:              " << (result.alarm              ? "true" : "false") << "\n"
+		<< "  error:              " << (result.error              ? "true" : "false") << "\n"
+		<< "  servo_on:           " << (result.servo_on           ? "true" : "false") << "\n"
+		;
+}
+
+void subscribe(udp::Client & client, std::unique_ptr<udp::Subscription> & subscription) {
+	udp::SubscriptionOptions options;
+	options.period   = poll_period;
+	options.status   = true;
+	options.position = ReadCurrentPosition{0, CoordinateSystemType::robot_cartesian};
+
+	subscription = std::make_unique<udp::Subscription>(client, options);
+	// Only changes are printed, not every poll.
+	subscription->on_change = [] (udp::SubscriptionSnapshot const & snapshot) {
+		printStatus(snapshot.status);
+		printPosition(snapshot.position);
+	};
+	subscription->on_error = [&client, &subscription] (Error const & error) {
+		std::cout << error.format() << "\n";
+		subscription->stop();
+		client.close();
+	};
+	subscription->start();
 }
 
-void connect(udp::Client & client, std::string host, std::string port) {
-	client.connect(host, port, timeout, [&client] (Error error) {
+void connect(udp::Client & client, std::unique_ptr<udp::Subscription> & subscription, std::string host, std::string port) {
+	client.connect(host, port, timeout, [&client, &subscription] (Error error) {
 		if (error) {
 			std::cout << error.format() << "\n";
 			client.close();
 			return;
 		}
 		std::cout << "Connected to " << client.socket().remote_endpoint() << ".\n";
-		readStatus(client);
+		subscribe(client, subscription);
 	});
 }
 
 int main(int argc, char * * argv) {
 	asio::io_service ios;
 	dr::yaskawa::udp::Client client(ios);
+	std::unique_ptr<udp::Subscription> subscription;
 
 	client.on_error = [&client] (Error const & error) {
 		std::cout << "Communication error: " << error.format() << "\n";
@@ -146,6 +149,6 @@ int main(int argc, char * * argv) {
 	if (argc > 1) host = argv[1];
 	if (argc > 2) port = argv[2];
 
-	connect(client, host, port);
+	connect(client, subscription, host, port);
 	ios.run();
 }
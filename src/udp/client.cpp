@@ -27,7 +27,11 @@
  */
 
 #include "../connect.hpp"
+#include "../file_contents.hpp"
+#include "./decode.hpp"
 #include "./read_file.hpp"
+#include "./receive_batch.hpp"
+#include "./send_queue.hpp"
 #include "./write_file.hpp"
 
 #include "commands.hpp"
@@ -35,23 +39,63 @@
 #include "udp/message.hpp"
 #include "udp/protocol.hpp"
 
+#include <asio/post.hpp>
+
 #include <atomic>
+#include <cerrno>
 #include <memory>
 #include <utility>
 
+#include <unistd.h>
+
 namespace dr {
 namespace yaskawa {
 namespace udp {
 
+namespace {
+	/// Invoke a callback with an error from the executor.
+	template<typename Callback>
+	void postError(Executor executor, Callback callback, Error error) {
+		asio::post(executor, [callback = std::move(callback), error = std::move(error)] () mutable {
+			std::move(callback)(std::move(error));
+		});
+	}
+
+	/// Get the key of a command for the per-command statistics.
+	std::uint32_t commandIndex(CommandKey key) {
+		return std::uint32_t(key.division) << 16 | key.command;
+	}
+
+	/// Write all data to a file descriptor.
+	Result<void> writeAll(int fd, std::string_view data) {
+		while (!data.empty()) {
+			ssize_t written = ::write(fd, data.data(), data.size());
+			if (written < 0) {
+				if (errno == EINTR) continue;
+				return Error{std::error_code{errno, std::generic_category()}, "writing file data to file descriptor " + std::to_string(fd)};
+			}
+			data.remove_prefix(written);
+		}
+		return estd::in_place_valid;
+	}
+}
+
 Client::Client(asio::io_service & ios) :
-	socket_(ios),
-	read_buffer_{std::make_unique<std::array<std::uint8_t, 512>>()} {}
+	socket_(asio::make_strand(ios)),
+	receive_batch_{std::make_unique<impl::ReceiveBatch>()},
+	send_queue_{std::make_unique<impl::SendQueue>()},
+	session_pool_{std::make_shared<impl::SessionPool>()},
+	deadlines_{socket_.get_executor(), session_pool_} {}
+
+Client::~Client() = default;
 
 void Client::connect(std::string const & host, std::string const & port, std::chrono::milliseconds timeout, ErrorCallback callback) {
-	auto on_connect = [this, callback = std::move(callback)] (Error error) {
-		onConnect(error, std::move(callback));
-	};
-	asyncResolveConnect({host, port}, timeout, socket_, on_connect);
+	dispatch([this, host, port, timeout, callback = std::move(callback)] () mutable {
+		auto on_connect = [this, callback = std::move(callback)] (Error error) {
+			onConnect(error, std::move(callback));
+		};
+		asyncResolveConnect({host, port}, timeout, socket_, on_connect);
+	});
 }
 
 void Client::connect(std::string const & host, std::uint16_t port, std::chrono::milliseconds timeout, ErrorCallback callback) {
@@ -59,17 +103,148 @@ void Client::connect(std::string const & host, std::uint16_t port, std::chrono::
 }
 
 void Client::close() {
-	socket_.close();
+	dispatch([this] () {
+		socket_.close();
+	});
+}
+
+Result<std::uint8_t> Client::allocateIds(std::size_t count) {
+	if (count == 0) return request_id_;
+	if (count > requests_.size() - ids_in_use_) {
+		return Error{errc::no_free_request_id, "allocating " + std::to_string(count) + " request IDs with " + std::to_string(ids_in_use_) + " IDs in use"};
+	}
+
+	// Look for a free range, starting at the next ID in round-robin order.
+	for (std::size_t offset = 0; offset < requests_.size(); ++offset) {
+		std::uint8_t first = request_id_ + offset;
+		std::size_t length = 0;
+		while (length < count && !requests_[std::uint8_t(first + length)].allocated) ++length;
+		if (length < count) {
+			offset += length;
+			continue;
+		}
+
+		for (std::size_t i = 0; i < count; ++i) requests_[std::uint8_t(first + i)].allocated = true;
+		ids_in_use_ += count;
+		request_id_  = first + count;
+		return first;
+	}
+
+	return Error{errc::no_free_request_id, "no contiguous range of " + std::to_string(count) + " free request IDs"};
+}
+
+void Client::releaseId(std::uint8_t request_id) {
+	OpenRequest & request = requests_[request_id];
+	if (request.active) throw std::logic_error("request_id " + std::to_string(request_id) + " still has a handler, can not release it");
+	if (!request.allocated) return;
+	request.allocated = false;
+	--ids_in_use_;
 }
 
 Client::HandlerToken Client::registerHandler(std::uint8_t request_id, std::function<void(ResponseHeader const &, std::string_view)> handler) {
-	auto result = requests_.insert({request_id, {std::chrono::steady_clock::now(), handler}});
-	if (!result.second) throw std::logic_error("request_id " + std::to_string(request_id) + " is already taken, can not register handler");
-	return result.first;
+	OpenRequest & request = requests_[request_id];
+	if (request.active) throw std::logic_error("request_id " + std::to_string(request_id) + " is already taken, can not register handler");
+	if (!request.allocated) {
+		request.allocated = true;
+		++ids_in_use_;
+	}
+	request.start_time = std::chrono::steady_clock::now();
+	request.on_reply   = std::move(handler);
+	request.active     = true;
+	return request_id;
 }
 
 void Client::removeHandler(HandlerToken token) {
-	requests_.erase(token);
+	OpenRequest & request = requests_[token];
+	request.active        = false;
+	request.on_reply      = nullptr;
+	request.transmissions = 0;
+	releaseId(token);
+}
+
+void Client::lingerHandler(HandlerToken token, std::chrono::steady_clock::duration linger, std::function<void(ResponseHeader const &, std::string_view)> on_reply) {
+	if (!on_reply) on_reply = [] (ResponseHeader const &, std::string_view) {};
+	requests_[token].on_reply      = std::move(on_reply);
+	requests_[token].transmissions = 0;
+	deadlines_.add(std::chrono::steady_clock::now() + linger, [this, token] () {
+		removeHandler(token);
+	});
+}
+
+void Client::setReadRetransmit(std::optional<RetransmitOptions> options) {
+	dispatch([this, options] () {
+		if (options) read_rtt_.emplace(*options);
+		else read_rtt_.reset();
+	});
+}
+
+void Client::setTracer(Tracer * tracer) {
+	dispatch([this, tracer] () {
+		tracer_ = tracer;
+	});
+}
+
+ClientStatistics Client::statistics() const {
+	ClientStatistics result = statistics_;
+	result.smoothed_rtt = rtt_.smoothedRtt();
+	result.rtt_variance = rtt_.rttVariance();
+	result.command_latency.reserve(command_latency_.size());
+	for (auto const & [index, histogram] : command_latency_) {
+		result.command_latency.push_back({{Division(index >> 16), std::uint16_t(index & 0xffff)}, histogram});
+	}
+	return result;
+}
+
+void Client::statistics(std::function<void(ClientStatistics)> callback) {
+	dispatch([this, callback = std::move(callback)] () {
+		callback(statistics());
+	});
+}
+
+void Client::send(asio::const_buffer header, asio::const_buffer payload, std::function<void(std::error_code)> on_error, void const * owner) {
+	++statistics_.messages_sent;
+
+	// Track the transmission if a response is expected for it.
+	// Acks sent for received file blocks do not get a direct response.
+	std::uint8_t const * data = static_cast<std::uint8_t const *>(header.data());
+	if (header.size() >= header_size && data[header_offset::ack] == 0) {
+		OpenRequest & request = requests_[data[header_offset::request_id]];
+		if (request.active) {
+			if (request.transmissions++ > 0) ++statistics_.retransmissions;
+			request.send_time = std::chrono::steady_clock::now();
+			request.command.division = Division(data[header_offset::division]);
+			if (request.command.division == Division::file) {
+				request.command.command = data[header_offset::service];
+			} else {
+				request.command.command = readLittleEndian<std::uint16_t>(data + header_offset::command);
+			}
+		}
+	}
+	if (header.size() >= header_size) trace(TraceEvent::send, data[header_offset::request_id]);
+
+	send_queue_->push({{header, payload}, std::move(on_error), owner});
+	if (flush_pending_) return;
+	flush_pending_ = true;
+	asio::post(get_executor(), impl::poolHandler(session_pool_, [this] () {
+		flushSends();
+	}));
+}
+
+void Client::cancelSends(void const * owner) {
+	send_queue_->cancel(owner);
+}
+
+void Client::flushSends() {
+	if (send_queue_->flush(socket_)) {
+		flush_pending_ = false;
+		return;
+	}
+
+	// The socket buffer is full, continue when there is room again.
+	socket_.async_wait(Socket::wait_write, impl::poolHandler(session_pool_, [this] (std::error_code error) {
+		if (error) send_queue_->failAll(error);
+		flushSends();
+	}));
 }
 
 // File control.
@@ -77,10 +252,14 @@ void Client::removeHandler(HandlerToken token) {
 void Client::readFileList(
 	std::string type,
 	std::chrono::milliseconds timeout,
-	std::function<void(Result<std::vector<std::string>>)> on_done,
+	std::function<void(Result<FileList>)> on_done,
 	std::function<void(std::size_t bytes_received)> on_progress
 ) {
-	impl::readFile(*this, request_id_++, ReadFileList{std::move(type)}, timeout, std::move(on_done), std::move(on_progress));
+	dispatch([this, type = std::move(type), timeout, on_done = std::move(on_done), on_progress = std::move(on_progress)] () mutable {
+		Result<std::uint8_t> request_id = allocateId();
+		if (!request_id) return postError(get_executor(), std::move(on_done), std::move(request_id.error_unchecked()));
+		impl::readFile(*this, *request_id, ReadFileList{std::move(type)}, timeout, std::move(on_done), std::move(on_progress));
+	});
 }
 
 void Client::readFile(
@@ -89,7 +268,37 @@ void Client::readFile(
 	std::function<void(Result<std::string>)> on_done,
 	std::function<void(std::size_t bytes_received)> on_progress
 ) {
-	impl::readFile(*this, request_id_++, ReadFile{std::move(name)}, timeout, std::move(on_done), std::move(on_progress));
+	dispatch([this, name = std::move(name), timeout, on_done = std::move(on_done), on_progress = std::move(on_progress)] () mutable {
+		Result<std::uint8_t> request_id = allocateId();
+		if (!request_id) return postError(get_executor(), std::move(on_done), std::move(request_id.error_unchecked()));
+		impl::readFile(*this, *request_id, ReadFile{std::move(name)}, timeout, std::move(on_done), std::move(on_progress));
+	});
+}
+
+void Client::readFileStreaming(
+	std::string name,
+	std::function<Result<void>(std::string_view data)> sink,
+	std::chrono::milliseconds timeout,
+	std::function<void(Result<void>)> on_done,
+	std::function<void(std::size_t bytes_received)> on_progress
+) {
+	dispatch([this, name = std::move(name), sink = std::move(sink), timeout, on_done = std::move(on_done), on_progress = std::move(on_progress)] () mutable {
+		Result<std::uint8_t> request_id = allocateId();
+		if (!request_id) return postError(get_executor(), std::move(on_done), std::move(request_id.error_unchecked()));
+		impl::readFile(*this, *request_id, ReadFileStreaming{std::move(name), std::move(sink)}, timeout, std::move(on_done), std::move(on_progress));
+	});
+}
+
+void Client::readFileStreaming(
+	std::string name,
+	int fd,
+	std::chrono::milliseconds timeout,
+	std::function<void(Result<void>)> on_done,
+	std::function<void(std::size_t bytes_received)> on_progress
+) {
+	readFileStreaming(std::move(name), [fd] (std::string_view data) {
+		return writeAll(fd, data);
+	}, timeout, std::move(on_done), std::move(on_progress));
 }
 
 void Client::writeFile(
@@ -97,9 +306,38 @@ void Client::writeFile(
 	std::string data,
 	std::chrono::milliseconds timeout,
 	std::function<void(Result<void>)> on_done,
-	std::function<void(std::size_t bytes_sent, std::size_t total_bytes)> on_progress
+	std::function<void(std::size_t bytes_sent, std::size_t total_bytes)> on_progress,
+	RetransmitOptions retransmit
 ) {
-	impl::writeFile(*this, request_id_++, WriteFile{std::move(name), std::move(data)}, timeout, std::move(on_done), std::move(on_progress));
+	dispatch([this, name = std::move(name), data = std::move(data), timeout, on_done = std::move(on_done), on_progress = std::move(on_progress), retransmit] () mutable {
+		Result<std::uint8_t> request_id = allocateId();
+		if (!request_id) return postError(get_executor(), std::move(on_done), std::move(request_id.error_unchecked()));
+		impl::writeFile(*this, *request_id, WriteFile{std::move(name), std::move(data)}, timeout, retransmit, std::move(on_done), std::move(on_progress));
+	});
+}
+
+void Client::writeFile(
+	std::string name,
+	int fd,
+	std::chrono::milliseconds timeout,
+	std::function<void(Result<void>)> on_done,
+	std::function<void(std::size_t bytes_sent, std::size_t total_bytes)> on_progress,
+	RetransmitOptions retransmit
+) {
+	Result<std::shared_ptr<FileContents>> contents = FileContents::open(fd);
+	if (!contents) return postError(get_executor(), std::move(on_done), std::move(contents.error_unchecked()));
+
+	dispatch([this, name = std::move(name), contents = std::move(*contents), timeout, on_done = std::move(on_done), on_progress = std::move(on_progress), retransmit] () mutable {
+		Result<std::uint8_t> request_id = allocateId();
+		if (!request_id) return postError(get_executor(), std::move(on_done), std::move(request_id.error_unchecked()));
+
+		// Keep the file contents alive until the session is done.
+		std::string_view data = contents->data();
+		auto on_session_done = [contents = std::move(contents), on_done = std::move(on_done)] (Result<void> result) {
+			on_done(std::move(result));
+		};
+		impl::writeFile(*this, *request_id, WriteFileView{std::move(name), data}, timeout, retransmit, std::move(on_session_done), std::move(on_progress));
+	});
 }
 
 void Client::deleteFile(
@@ -121,11 +359,11 @@ void Client::receive() {
 	// Make sure we stop reading if the socket is closed.
 	// Otherwise in rare cases we can miss an operation_canceled and continue reading forever.
 	if (!socket_.is_open()) return;
-	auto callback = std::bind(&Client::onReceive, this, std::placeholders::_1, std::placeholders::_2);
-	socket_.async_receive(asio::buffer(read_buffer_->data(), read_buffer_->size()), callback);
+	auto callback = std::bind(&Client::onReadable, this, std::placeholders::_1);
+	socket_.async_wait(Socket::wait_read, impl::poolHandler(session_pool_, callback));
 }
 
-void Client::onReceive(std::error_code error, std::size_t message_size) {
+void Client::onReadable(std::error_code error) {
 	if (error == std::errc::operation_canceled) return;
 	if (error) {
 		if (on_error) on_error(make_error_code(std::errc(error.value())));
@@ -133,27 +371,58 @@ void Client::onReceive(std::error_code error, std::size_t message_size) {
 		return;
 	}
 
+	// Drain all pending messages, a batch at a time.
+	// A handler may close the socket, so check before every batch.
+	while (socket_.is_open()) {
+		std::size_t count = receive_batch_->read(socket_, error);
+		for (std::size_t i = 0; i < count; ++i) onMessage(receive_batch_->message(i));
+		if (error) {
+			if (on_error) on_error(make_error_code(std::errc(error.value())));
+			error.clear();
+		}
+		if (count < impl::ReceiveBatch::max_messages) break;
+	}
+
+	receive();
+}
+
+void Client::onMessage(std::string_view message) {
+	++statistics_.messages_received;
+
 	// Decode the response header.
-	std::string_view message{reinterpret_cast<char const *>(read_buffer_->data()), message_size};
 	Result<ResponseHeader> header = decodeResponseHeader(message);
 	if (!header) {
+		++statistics_.malformed_responses;
 		if (on_error) on_error(header.error());
-		receive();
 		return;
 	}
 
+	trace(TraceEvent::receive, header->request_id);
+
 	// Find the right handler for the response.
-	auto handler = requests_.find(header->request_id);
-	if (handler == requests_.end()) {
+	OpenRequest & request = requests_[header->request_id];
+	if (!request.active) {
+		++statistics_.unexpected_responses;
 		if (on_error) on_error({errc::unknown_request, "no handler for request id " + std::to_string(header->request_id)});
-		receive();
 		return;
 	}
 
-	// Invoke the handler (a copy, so it can erase itself safely).
-	auto callback = handler->second.on_reply;
+	// Only the first response to a transmission is measured, later ones are duplicates.
+	if (request.transmissions > 0) {
+		std::chrono::nanoseconds latency = std::chrono::steady_clock::now() - request.send_time;
+		statistics_.latency.add(latency);
+		command_latency_[commandIndex(request.command)].add(latency);
+		if (request.transmissions == 1) rtt_.sample(latency);
+		request.transmissions = 0;
+	}
+
+	// Move the handler out of the table while it runs, so it can remove itself safely.
+	// If it is still registered afterwards (and the slot wasn't re-used), put it back.
+	auto callback = std::exchange(request.on_reply, nullptr);
+	std::chrono::steady_clock::time_point dispatch_start = traceNow();
 	callback(*header, message);
-	receive();
+	trace(TraceEvent::dispatch, header->request_id, dispatch_start, traceNow());
+	if (request.active && !request.on_reply) request.on_reply = std::move(callback);
 }
 
 }}}
@@ -88,6 +88,52 @@ Result<ResponseHeader> decodeResponseHeader(std::string_view & data) {
 	return result;
 }
 
+Result<RequestHeader> decodeRequestHeader(std::string_view & data) {
+	std::string_view original = data;
+	RequestHeader result;
+
+	// Check that the message is large enough to hold the header.
+	if (auto error = expectSizeMin("request", data.size(), header_size)) return error;
+
+	// Check the magic bytes.
+	if (data.substr(0, 4) != "YERC") return malformedResponse("request does not start with magic bytes `YERC'");
+	data.remove_prefix(4);
+
+	// Check the header size.
+	std::uint16_t parsed_header_size = readLittleEndian<std::uint16_t>(data);
+	if (auto error = expectValue("header size", parsed_header_size, header_size)) return error;
+
+	// Get payload size.
+	result.payload_size = readLittleEndian<std::uint16_t>(data);
+	if (auto error = expectValueMax("payload size", result.payload_size, max_payload_size)) return error;
+
+	data.remove_prefix(1);
+	result.division     = Division(readLittleEndian<std::uint8_t>(data));
+	result.ack          = readLittleEndian<std::uint8_t>(data);
+	result.request_id   = readLittleEndian<std::uint8_t>(data);
+	result.block_number = readLittleEndian<std::uint32_t>(data);
+
+	// Reserved 8 bytes.
+	data.remove_prefix(8);
+
+	result.command   = readLittleEndian<std::uint16_t>(data);
+	result.instance  = readLittleEndian<std::uint16_t>(data);
+	result.attribute = readLittleEndian<std::uint8_t>(data);
+	result.service   = readLittleEndian<std::uint8_t>(data);
+
+	// Padding.
+	data.remove_prefix(2);
+
+	if (original.size() != header_size + result.payload_size) return malformedResponse(
+		"request " + std::to_string(int(result.request_id)) + ": "
+		"number of received bytes (" + std::to_string(original.size()) + ") "
+		"does not match the message size according to the header "
+		"(" + std::to_string(header_size + result.payload_size) + ")"
+	);
+
+	return result;
+}
+
 template<> Result<std::uint8_t> decode<std::uint8_t>(std::string_view & data) {
 	return readLittleEndian<std::uint8_t>(data);
 }
@@ -100,8 +146,9 @@ template<> Result<std::int32_t> decode<std::int32_t>(std::string_view & data) {
 }
 
 template<> Result<float> decode<float>(std::string_view & data) {
-	std::uint32_t integral = readLittleEndian<std::uint32_t>(data);
-	return reinterpret_cast<float const &>(integral);
+	float result;
+	if (auto error = decodeArray(data, &result, 1)) return error;
+	return result;
 }
 
 namespace {
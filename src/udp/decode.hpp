@@ -27,11 +27,13 @@
  */
 
 #pragma once
+#include "byte_order.hpp"
 #include "error.hpp"
 #include "types.hpp"
 #include "udp/message.hpp"
 
 #include <cstdint>
+#include <cstring>
 #include <string>
 #include <string_view>
 #include <type_traits>
@@ -45,11 +47,9 @@ namespace udp {
 template<typename T>
 T readLittleEndian(std::uint8_t const * data) {
 	static_assert(std::is_integral<T>::value, "T must be an integral type.");
-	T result = 0;
-	for (unsigned int i = 0; i < sizeof(T); ++i) {
-		result |= data[i] << i * 8;
-	}
-	return result;
+	T result;
+	std::memcpy(&result, data, sizeof(T));
+	return hostToLittleEndian(result);
 }
 
 /// Read and remove little-endian integral data from the front of a string view.
@@ -59,9 +59,56 @@ T readLittleEndian(std::string_view & data) {
 	return readLittleEndian<T>(reinterpret_cast<std::uint8_t const *>(data.data() - sizeof(T)));
 }
 
+/// If true, an array of T can be decoded by copying the wire data directly.
+/**
+ * True for the scalar variable types whose wire format is
+ * the little-endian representation of the host type.
+ */
+template<typename T> struct is_bulk_decodable : std::false_type {};
+template<> struct is_bulk_decodable<std::uint8_t> : std::true_type {};
+template<> struct is_bulk_decodable<std::int16_t> : std::true_type {};
+template<> struct is_bulk_decodable<std::int32_t> : std::true_type {};
+template<> struct is_bulk_decodable<float>        : std::true_type {};
+
+/// Decode a packed array of values into a caller supplied buffer and remove it from the front of the data.
+/**
+ * The size is checked once for the whole array.
+ * On little-endian hosts the conversion is a single memcpy,
+ * on big-endian hosts each value is byte-swapped in place afterwards.
+ *
+ * \return An empty error on success.
+ */
+template<typename T>
+Error decodeArray(std::string_view & data, T * output, std::size_t count) {
+	static_assert(is_bulk_decodable<T>::value, "T must be a bulk decodable type.");
+	if (auto error = expectSizeMin("array data", data.size(), count * sizeof(T))) return error;
+
+	std::memcpy(output, data.data(), count * sizeof(T));
+	data.remove_prefix(count * sizeof(T));
+
+	if constexpr (!host_is_little_endian && sizeof(T) > 1) {
+		using Integral = std::conditional_t<sizeof(T) == 2, std::uint16_t, std::uint32_t>;
+		for (std::size_t i = 0; i < count; ++i) {
+			Integral value;
+			std::memcpy(&value, output + i, sizeof(T));
+			value = byteSwap(value);
+			std::memcpy(output + i, &value, sizeof(T));
+		}
+	}
+
+	return {};
+}
+
 /// Decode a response header.
 Result<ResponseHeader> decodeResponseHeader(std::string_view & data);
 
+/// Decode a request header.
+/**
+ * This is the controller side of the protocol, used by the mock server.
+ * Unlike responses, requests may have the ack flag set (file transfer acks from the client).
+ */
+Result<RequestHeader> decodeRequestHeader(std::string_view & data);
+
 /// Generic decode function for raw types.
 template<typename T>
 Result<T> decode(std::string_view & data);
@@ -74,54 +74,61 @@ RequestHeader makeFileRequestHeader(
 	return header;
 }
 
-void encode(std::vector<std::uint8_t> & out, RequestHeader const & header) {
-	out.reserve(out.size() + header_size + header.payload_size);
-	// Magic bytes.
-	out.insert(out.end(), {'Y', 'E', 'R', 'C'});
-
-	// Header size, payload size.
-	writeLittleEndian<std::uint16_t>(out, header_size);
-	writeLittleEndian<std::uint16_t>(out, header.payload_size);
-
-	// Reserved magic constant.
-	out.push_back(3);
-
-	// "Division" (robot command or file command)
-	out.push_back(std::uint8_t(header.division));
-
-	// Ack (should always be zero for requests).
-	out.push_back(header.ack);
-
-	// Request ID.
-	out.push_back(header.request_id);
-
-	// Block number.
-	writeLittleEndian<std::uint32_t>(out, header.block_number);
-
-	// Reserved.
-	out.insert(out.end(), 8, '9');
+std::uint8_t * encode(std::uint8_t * out, RequestHeader const & header) {
+	constexpr EncodedHeader header_template = makeHeaderTemplate(Division::robot);
+
+	std::memcpy(out, header_template.data(), header_size);
+	storeLittleEndian(out + header_offset::payload_size, header.payload_size);
+	out[header_offset::division]   = std::uint8_t(header.division);
+	out[header_offset::ack]        = header.ack;
+	out[header_offset::request_id] = header.request_id;
+	storeLittleEndian(out + header_offset::block_number, header.block_number);
+	storeLittleEndian(out + header_offset::command,      header.command);
+	storeLittleEndian(out + header_offset::instance,     header.instance);
+	out[header_offset::attribute] = header.attribute;
+	out[header_offset::service]   = header.service;
+	return out + header_size;
+}
 
-	// Subrequest details
-	writeLittleEndian<std::uint16_t>(out, header.command);
-	writeLittleEndian<std::uint16_t>(out, header.instance);
-	out.push_back(header.attribute);
-	out.push_back(header.service);
+std::uint8_t * encode(std::uint8_t * out, ResponseHeader const & header) {
+	constexpr EncodedHeader header_template = makeHeaderTemplate(Division::robot);
+
+	std::memcpy(out, header_template.data(), header_size);
+	storeLittleEndian(out + header_offset::payload_size, header.payload_size);
+	out[header_offset::division]   = std::uint8_t(header.division);
+	out[header_offset::ack]        = header.ack;
+	out[header_offset::request_id] = header.request_id;
+	storeLittleEndian(out + header_offset::block_number, header.block_number);
+
+	// The response fields overlap the request specific fields.
+	out[24] = header.service;
+	out[25] = header.status;
+	out[26] = header.extra_status ? 1 : 0; // Added status size in words.
+	out[27] = 0;
+	storeLittleEndian(out + 28, header.extra_status);
+	out[30] = 0;
+	out[31] = 0;
+	return out + header_size;
+}
 
-	// Padding.
-	out.insert(out.end(), 2, 0);
+void encode(std::vector<std::uint8_t> & out, RequestHeader const & header) {
+	encode(extend(out, header_size), header);
 }
 
-void encode(std::vector<std::uint8_t> & out, std::uint8_t value) {
-	writeLittleEndian<std::uint8_t>(out, value);
+std::uint8_t * encode(std::uint8_t * out, std::uint8_t value) {
+	*out = value;
+	return out + 1;
 }
-void encode(std::vector<std::uint8_t> & out, std::int16_t value) {
-	writeLittleEndian<std::int16_t>(out, value);
+std::uint8_t * encode(std::uint8_t * out, std::int16_t value) {
+	return storeLittleEndian(out, value);
 }
-void encode(std::vector<std::uint8_t> & out, std::int32_t value) {
-	writeLittleEndian<std::int32_t>(out, value);
+std::uint8_t * encode(std::uint8_t * out, std::int32_t value) {
+	return storeLittleEndian(out, value);
 }
-void encode(std::vector<std::uint8_t> & out, float value) {
-	writeLittleEndian<std::uint32_t>(out, reinterpret_cast<std::uint32_t const &>(value));
+std::uint8_t * encode(std::uint8_t * out, float value) {
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return storeLittleEndian(out, bits);
 }
 
 namespace {
@@ -136,52 +143,54 @@ namespace {
 	}
 }
 
-void encode(std::vector<std::uint8_t> & out, Position const & position) {
-	if (position.isPulse()) encode(out, position.pulse());
-	else encode(out, position.cartesian());
+std::uint8_t * encode(std::uint8_t * out, Position const & position) {
+	if (position.isPulse()) return encode(out, position.pulse());
+	else return encode(out, position.cartesian());
 }
 
-void encode(std::vector<std::uint8_t> & out, PulsePosition const & position) {
+std::uint8_t * encode(std::uint8_t * out, PulsePosition const & position) {
 	// Position type: pulse.
-	writeLittleEndian<std::uint32_t>(out, 0);
+	out = storeLittleEndian<std::uint32_t>(out, 0);
 	// Joint configuration, meaningless with pulse positions.
-	writeLittleEndian<std::uint32_t>(out, 0);
+	out = storeLittleEndian<std::uint32_t>(out, 0);
 	// Tool number. Also meaningless for pulse positions?
-	writeLittleEndian<std::uint32_t>(out, position.tool());
+	out = storeLittleEndian<std::uint32_t>(out, position.tool());
 	// User coordinate: meaningless for pulse position.
-	writeLittleEndian<std::uint32_t>(out, 0);
+	out = storeLittleEndian<std::uint32_t>(out, 0);
 	// Extended joint configuration, meaningless with pulse positions.
-	writeLittleEndian<std::uint32_t>(out, 0);
+	out = storeLittleEndian<std::uint32_t>(out, 0);
 	// Invividual joint values in pulses.
-	for (std::int32_t value : position.joints()) writeLittleEndian<std::int32_t>(out, value);
+	for (std::int32_t value : position.joints()) out = storeLittleEndian<std::int32_t>(out, value);
 	// Padding (robot wants 8 coordinates).
 	for (unsigned int i = position.joints().size(); i < 8; ++i) {
-		writeLittleEndian<std::int32_t>(out, 0);
+		out = storeLittleEndian<std::int32_t>(out, 0);
 	}
+	return out;
 }
 
-void encode(std::vector<std::uint8_t> & out, CartesianPosition const & position) {
+std::uint8_t * encode(std::uint8_t * out, CartesianPosition const & position) {
 	// Position type.
-	writeLittleEndian<std::uint32_t>(out, encodeFrameType(position.frame()));
+	out = storeLittleEndian<std::uint32_t>(out, encodeFrameType(position.frame()));
 	// Joint configuration.
-	writeLittleEndian<std::uint32_t>(out, position.configuration());
+	out = storeLittleEndian<std::uint32_t>(out, position.configuration());
 	// Tool number.
-	writeLittleEndian<std::uint32_t>(out, position.tool());
+	out = storeLittleEndian<std::uint32_t>(out, position.tool());
 	// User coordinate system.
-	writeLittleEndian<std::uint32_t>(out, userCoordinateNumber(position.frame()));
+	out = storeLittleEndian<std::uint32_t>(out, userCoordinateNumber(position.frame()));
 	// Extended joint configuration, not supported.
-	writeLittleEndian<std::uint32_t>(out, 0);
+	out = storeLittleEndian<std::uint32_t>(out, 0);
 	// XYZ components in micrometer.
-	writeLittleEndian<std::int32_t>(out, position[0] * 1000);
-	writeLittleEndian<std::int32_t>(out, position[1] * 1000);
-	writeLittleEndian<std::int32_t>(out, position[2] * 1000);
+	out = storeLittleEndian<std::int32_t>(out, position[0] * 1000);
+	out = storeLittleEndian<std::int32_t>(out, position[1] * 1000);
+	out = storeLittleEndian<std::int32_t>(out, position[2] * 1000);
 	// Rotation components in millidegrees.
-	writeLittleEndian<std::int32_t>(out, position[3] * 10000);
-	writeLittleEndian<std::int32_t>(out, position[4] * 10000);
-	writeLittleEndian<std::int32_t>(out, position[5] * 10000);
+	out = storeLittleEndian<std::int32_t>(out, position[3] * 10000);
+	out = storeLittleEndian<std::int32_t>(out, position[4] * 10000);
+	out = storeLittleEndian<std::int32_t>(out, position[5] * 10000);
 	// Padding (robot wants 8 coordinates).
-	writeLittleEndian<std::int32_t>(out, 0);
-	writeLittleEndian<std::int32_t>(out, 0);
+	out = storeLittleEndian<std::int32_t>(out, 0);
+	out = storeLittleEndian<std::int32_t>(out, 0);
+	return out;
 }
 
 }}}
@@ -27,10 +27,13 @@
  */
 
 #pragma once
+#include "byte_order.hpp"
 #include "types.hpp"
 #include "udp/message.hpp"
 
+#include <array>
 #include <cstdint>
+#include <cstring>
 #include <type_traits>
 #include <vector>
 
@@ -38,6 +41,9 @@ namespace dr {
 namespace yaskawa {
 namespace udp {
 
+/// An encoded request header.
+using EncodedHeader = std::array<std::uint8_t, header_size>;
+
 RequestHeader makeRobotRequestHeader(
 	std::uint16_t payload_size,
 	std::uint16_t command,
@@ -55,21 +61,86 @@ RequestHeader makeFileRequestHeader(
 	bool ack = false
 );
 
+/// Make a header template with all fields that are fixed for a command filled in.
+/**
+ * The template can be computed at compile time.
+ * Use encodeHeader() to copy it into a message and fill in the remaining fields.
+ */
+constexpr EncodedHeader makeHeaderTemplate(
+	Division division,
+	std::uint16_t command   = 0,
+	std::uint8_t  attribute = 0,
+	std::uint8_t  service   = 0
+) {
+	return {{
+		'Y', 'E', 'R', 'C',
+		header_size & 0xff, header_size >> 8,
+		0, 0,                                     // Payload size.
+		3,                                        // Reserved magic constant.
+		std::uint8_t(division),
+		0,                                        // Ack.
+		0,                                        // Request ID.
+		0, 0, 0, 0,                               // Block number.
+		'9', '9', '9', '9', '9', '9', '9', '9',   // Reserved.
+		std::uint8_t(command & 0xff), std::uint8_t(command >> 8),
+		0, 0,                                     // Instance.
+		attribute,
+		service,
+		0, 0,                                     // Padding.
+	}};
+}
+
+/// Store integral data in little-endian byte order.
+/**
+ * \return A pointer one past the written data.
+ */
 template<typename T>
-void writeLittleEndian(std::vector<std::uint8_t> & out, T value) {
+std::uint8_t * storeLittleEndian(std::uint8_t * out, T value) {
 	static_assert(std::is_integral<T>::value, "T must be an integral type.");
-	for (unsigned int i = 0; i < sizeof(T); ++i) {
-		out.push_back(value >> i * 8 & 0xff);
-	}
+	value = hostToLittleEndian(value);
+	std::memcpy(out, &value, sizeof(T));
+	return out + sizeof(T);
 }
 
+/// Grow a buffer by a number of bytes and get a pointer to the new bytes.
+/**
+ * The new bytes are meant to be overwritten by the encode functions.
+ * If the buffer has enough capacity this does not allocate.
+ */
+inline std::uint8_t * extend(std::vector<std::uint8_t> & out, std::size_t size) {
+	std::size_t offset = out.size();
+	out.resize(offset + size);
+	return out.data() + offset;
+}
+
+/// Copy a header template into a message and fill in the request specific fields.
+/**
+ * \return A pointer one past the header, where the payload starts.
+ */
+inline std::uint8_t * encodeHeader(
+	std::uint8_t * out,
+	EncodedHeader const & header_template,
+	std::uint16_t payload_size,
+	std::uint8_t  request_id,
+	std::uint16_t instance = 0
+) {
+	std::memcpy(out, header_template.data(), header_size);
+	storeLittleEndian(out + header_offset::payload_size, payload_size);
+	out[header_offset::request_id] = request_id;
+	storeLittleEndian(out + header_offset::instance, instance);
+	return out + header_size;
+}
+
+std::uint8_t * encode(std::uint8_t * out, RequestHeader const & header);
+std::uint8_t * encode(std::uint8_t * out, ResponseHeader const & header);
+std::uint8_t * encode(std::uint8_t * out, std::uint8_t value);
+std::uint8_t * encode(std::uint8_t * out, std::int16_t value);
+std::uint8_t * encode(std::uint8_t * out, std::int32_t value);
+std::uint8_t * encode(std::uint8_t * out, float value);
+std::uint8_t * encode(std::uint8_t * out, PulsePosition const & position);
+std::uint8_t * encode(std::uint8_t * out, CartesianPosition const & position);
+std::uint8_t * encode(std::uint8_t * out, Position const & position);
+
 void encode(std::vector<std::uint8_t> & out, RequestHeader const & header);
-void encode(std::vector<std::uint8_t> & out, std::uint8_t value);
-void encode(std::vector<std::uint8_t> & out, std::int16_t value);
-void encode(std::vector<std::uint8_t> & out, std::int32_t value);
-void encode(std::vector<std::uint8_t> & out, float value);
-void encode(std::vector<std::uint8_t> & out, PulsePosition const & position);
-void encode(std::vector<std::uint8_t> & out, CartesianPosition const & position);
-void encode(std::vector<std::uint8_t> & out, Position const & position);
 
 }}}
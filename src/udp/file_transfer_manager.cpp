@@ -0,0 +1,136 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "udp/file_transfer_manager.hpp"
+#include "udp/message.hpp"
+
+#include <asio/dispatch.hpp>
+#include <asio/post.hpp>
+
+#include <memory>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+FileTransferManager::FileTransferManager(Client & client, FileTransferOptions options) :
+	client_{&client},
+	options_{std::move(options)} {}
+
+void FileTransferManager::download(std::string name, std::function<Result<void>(std::string_view data)> sink, DoneCallback on_done) {
+	enqueue({max_payload_size, [this, name = std::move(name), sink = std::move(sink)] (DoneCallback on_done, std::function<void(std::size_t)> on_progress) mutable {
+		client_->readFileStreaming(std::move(name), std::move(sink), options_.timeout, std::move(on_done), std::move(on_progress));
+	}, std::move(on_done)});
+}
+
+void FileTransferManager::download(std::string name, int fd, DoneCallback on_done) {
+	enqueue({max_payload_size, [this, name = std::move(name), fd] (DoneCallback on_done, std::function<void(std::size_t)> on_progress) mutable {
+		client_->readFileStreaming(std::move(name), fd, options_.timeout, std::move(on_done), std::move(on_progress));
+	}, std::move(on_done)});
+}
+
+void FileTransferManager::upload(std::string name, std::string data, DoneCallback on_done) {
+	std::size_t cost = data.size();
+	enqueue({cost, [this, name = std::move(name), data = std::move(data)] (DoneCallback on_done, std::function<void(std::size_t)> on_progress) mutable {
+		client_->writeFile(std::move(name), std::move(data), options_.timeout, std::move(on_done), [on_progress = std::move(on_progress)] (std::size_t bytes_sent, std::size_t) {
+			on_progress(bytes_sent);
+		}, options_.retransmit);
+	}, std::move(on_done)});
+}
+
+void FileTransferManager::upload(std::string name, int fd, DoneCallback on_done) {
+	// Other file descriptors would be read to the end on the strand of the client, blocking it.
+	struct ::stat info;
+	if (::fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+		Error error{std::errc::invalid_argument, "uploading " + name + ": file descriptor " + std::to_string(fd) + " is not a regular file"};
+		asio::post(client_->get_executor(), [on_done = std::move(on_done), error = std::move(error)] () mutable {
+			if (on_done) on_done(std::move(error));
+		});
+		return;
+	}
+
+	off_t offset = ::lseek(fd, 0, SEEK_CUR);
+	std::size_t cost = offset >= 0 && offset < info.st_size ? info.st_size - offset : 0;
+
+	enqueue({cost, [this, name = std::move(name), fd] (DoneCallback on_done, std::function<void(std::size_t)> on_progress) mutable {
+		client_->writeFile(std::move(name), fd, options_.timeout, std::move(on_done), [on_progress = std::move(on_progress)] (std::size_t bytes_sent, std::size_t) {
+			on_progress(bytes_sent);
+		}, options_.retransmit);
+	}, std::move(on_done)});
+}
+
+void FileTransferManager::enqueue(Transfer transfer) {
+	asio::dispatch(client_->get_executor(), [this, transfer = std::move(transfer)] () mutable {
+		queue_.push_back(std::move(transfer));
+		++files_total_;
+		startTransfers();
+	});
+}
+
+void FileTransferManager::startTransfers() {
+	while (!queue_.empty() && active_ < options_.max_sessions) {
+		std::size_t cost = queue_.front().cost;
+		if (active_ > 0 && bytes_in_flight_ + cost > options_.max_bytes_in_flight) break;
+
+		Transfer transfer = std::move(queue_.front());
+		queue_.pop_front();
+		++active_;
+		bytes_in_flight_ += cost;
+
+		// The progress of a single transfer is cumulative, so keep track of the last reported value.
+		auto last_progress = std::make_shared<std::size_t>(0);
+		auto report_progress = [this, last_progress] (std::size_t bytes) {
+			bytes_transferred_ += bytes - *last_progress;
+			*last_progress = bytes;
+			if (on_progress) on_progress(bytes_transferred_, files_done_, files_total_);
+		};
+		auto finish = [this, cost, on_done = std::move(transfer.on_done)] (Result<void> result) {
+			onTransferDone(cost, on_done, std::move(result));
+		};
+		transfer.start(std::move(finish), std::move(report_progress));
+	}
+}
+
+void FileTransferManager::onTransferDone(std::size_t cost, DoneCallback const & on_done, Result<void> result) {
+	--active_;
+	bytes_in_flight_ -= cost;
+	++files_done_;
+	if (on_done) on_done(std::move(result));
+	if (on_progress) on_progress(bytes_transferred_, files_done_, files_total_);
+
+	startTransfers();
+	if (active_ == 0 && queue_.empty() && on_idle) on_idle();
+}
+
+}}}
@@ -34,6 +34,10 @@
 #include "encode.hpp"
 #include "decode.hpp"
 
+#include <algorithm>
+#include <array>
+#include <type_traits>
+
 namespace dr {
 namespace yaskawa {
 namespace udp {
@@ -42,17 +46,11 @@ using namespace std::string_literals;
 
 /// Encode a ReadStatus command.
 void encode(std::vector<std::uint8_t> & output, std::uint8_t request_id, ReadStatus const &) {
-	int payload_size = 0;
-	int instance = 1;
-	int attribute = 0;
-	encode(output, makeRobotRequestHeader(
-		payload_size,
-		commands::robot::read_status_information,
-		instance,
-		attribute,
-		service::get_all,
-		request_id
-	));
+	constexpr int payload_size = 0;
+	constexpr int instance     = 1;
+	constexpr int attribute    = 0;
+	constexpr EncodedHeader header = makeHeaderTemplate(Division::robot, commands::robot::read_status_information, attribute, service::get_all);
+	encodeHeader(extend(output, header_size + payload_size), header, payload_size, request_id, instance);
 }
 
 /// Decode a ReadStatus response.
@@ -91,14 +89,8 @@ void encode(std::vector<std::uint8_t> & output, std::uint8_t request_id, ReadCur
 		case CoordinateSystemType::robot_cartesian: instance += 101; break;
 	}
 
-	encode(output, makeRobotRequestHeader(
-		payload_size,
-		commands::robot::read_robot_position,
-		instance,
-		attribute,
-		service::get_all,
-		request_id
-	));
+	constexpr EncodedHeader header = makeHeaderTemplate(Division::robot, commands::robot::read_robot_position, attribute, service::get_all);
+	encodeHeader(extend(output, header_size + payload_size), header, payload_size, request_id, instance);
 }
 
 /// Decode a ReadCurrentPosition command.
@@ -106,10 +98,9 @@ Result<Position> decode(ResponseHeader const &, std::string_view & message, Read
 	if (auto error = expectSizeMax("position data", message.size(), 13 * 4)) return error;
 
 	// Pad the data until it is 13 * 4 bytes.
-	std::string padded_data;
-	padded_data.resize(13 * 4, '\0');
+	std::array<char, 13 * 4> padded_data{};
 	std::copy(message.begin(), message.end(), padded_data.begin());
-	std::string_view padded_view = padded_data;
+	std::string_view padded_view{padded_data.data(), padded_data.size()};
 	return decode<Position>(padded_view);
 }
 
@@ -130,39 +121,33 @@ void encode(std::vector<std::uint8_t> & output, std::uint8_t request_id, MoveL c
 	constexpr int instance     = 2; // Absolute cartesian interpolated move.
 	constexpr int attribute    = 1;
 
-	encode(output, makeRobotRequestHeader(
-		payload_size,
-		commands::robot::read_robot_position,
-		instance,
-		attribute,
-		service::get_all,
-		request_id
-	));
-
-	writeLittleEndian<std::uint32_t>(output, command.control_group + 1);
-	writeLittleEndian<std::uint32_t>(output, 0); // Station control group.
-	writeLittleEndian<std::uint32_t>(output, std::int32_t(command.speed.type));
-	writeLittleEndian<std::uint32_t>(output, std::int32_t(command.speed.value));
-	writeLittleEndian<std::uint32_t>(output, systemToMoveLSystem(command.target.frame()));
+	constexpr EncodedHeader header = makeHeaderTemplate(Division::robot, commands::robot::read_robot_position, attribute, service::get_all);
+	std::uint8_t * out = encodeHeader(extend(output, header_size + payload_size), header, payload_size, request_id, instance);
+
+	out = storeLittleEndian<std::uint32_t>(out, command.control_group + 1);
+	out = storeLittleEndian<std::uint32_t>(out, 0); // Station control group.
+	out = storeLittleEndian<std::uint32_t>(out, std::int32_t(command.speed.type));
+	out = storeLittleEndian<std::uint32_t>(out, std::int32_t(command.speed.value));
+	out = storeLittleEndian<std::uint32_t>(out, systemToMoveLSystem(command.target.frame()));
 
 	// Translation coordinates in 1e-6 meters.
-	writeLittleEndian<std::int32_t>(output, command.target[0] * 1000);
-	writeLittleEndian<std::int32_t>(output, command.target[1] * 1000);
-	writeLittleEndian<std::int32_t>(output, command.target[2] * 1000);
+	out = storeLittleEndian<std::int32_t>(out, command.target[0] * 1000);
+	out = storeLittleEndian<std::int32_t>(out, command.target[1] * 1000);
+	out = storeLittleEndian<std::int32_t>(out, command.target[2] * 1000);
 	// Rotation components in 1e-4 degrees.
-	writeLittleEndian<std::int32_t>(output, command.target[3] * 10000);
-	writeLittleEndian<std::int32_t>(output, command.target[4] * 10000);
-	writeLittleEndian<std::int32_t>(output, command.target[5] * 10000);
+	out = storeLittleEndian<std::int32_t>(out, command.target[3] * 10000);
+	out = storeLittleEndian<std::int32_t>(out, command.target[4] * 10000);
+	out = storeLittleEndian<std::int32_t>(out, command.target[5] * 10000);
 
-	writeLittleEndian<std::uint32_t>(output, 0); // reserved
-	writeLittleEndian<std::uint32_t>(output, 0); // reserved
-	writeLittleEndian<std::uint32_t>(output, command.target.configuration());
-	writeLittleEndian<std::uint32_t>(output, 0); // extended type
-	writeLittleEndian<std::uint32_t>(output, command.target.tool());
-	writeLittleEndian<std::uint32_t>(output, userCoordinateNumber(command.target.frame()));
+	out = storeLittleEndian<std::uint32_t>(out, 0); // reserved
+	out = storeLittleEndian<std::uint32_t>(out, 0); // reserved
+	out = storeLittleEndian<std::uint32_t>(out, command.target.configuration());
+	out = storeLittleEndian<std::uint32_t>(out, 0); // extended type
+	out = storeLittleEndian<std::uint32_t>(out, command.target.tool());
+	out = storeLittleEndian<std::uint32_t>(out, userCoordinateNumber(command.target.frame()));
 
 	// unsupported base and station axes.
-	for (int i = 18; i <= 26; ++i) writeLittleEndian<std::uint32_t>(output, 0);
+	for (int i = 18; i <= 26; ++i) out = storeLittleEndian<std::uint32_t>(out, 0);
 }
 
 /// Decode a MoveL response.
@@ -175,7 +160,8 @@ namespace {
 	/// Encode a ReadVar command.
 	template<typename T>
 	void encodeReadVar(std::vector<std::uint8_t> & output, std::uint8_t request_id, ReadVar<T> const & command) {
-		encode(output, makeRobotRequestHeader(0, udp_command<ReadVar<T>>(), command.index, 0, service::get_all, request_id));
+		constexpr EncodedHeader header = makeHeaderTemplate(Division::robot, udp_command<ReadVar<T>>(), 0, service::get_all);
+		encodeHeader(extend(output, header_size), header, 0, request_id, command.index);
 	}
 
 	/// Encode a ReadVars command.
@@ -184,8 +170,9 @@ namespace {
 		if (command.count == 1) {
 			encodeReadVar(output, request_id, ReadVar<T>{command.index});
 		} else {
-			encode(output, makeRobotRequestHeader(4, udp_command<ReadVars<T>>(), command.index, 0, service::read_multiple, request_id));
-			writeLittleEndian<std::uint32_t>(output, command.count);
+			constexpr EncodedHeader header = makeHeaderTemplate(Division::robot, udp_command<ReadVars<T>>(), 0, service::read_multiple);
+			std::uint8_t * out = encodeHeader(extend(output, header_size + 4), header, 4, request_id, command.index);
+			storeLittleEndian<std::uint32_t>(out, command.count);
 		}
 	}
 
@@ -197,39 +184,72 @@ namespace {
 		return decode<T>(message);
 	}
 
-	/// Decode a ReadVars response.
+	/// Decode values into a buffer.
 	template<typename T>
-	Result<std::vector<T>> decodeReadVars(std::string_view & message, ReadVars<T> const & command) {
+	Error decodeValues(std::string_view & message, T * output, std::size_t count) {
+		if constexpr (is_bulk_decodable<T>::value) {
+			return decodeArray(message, output, count);
+		} else {
+			for (std::size_t i = 0; i < count; ++i) {
+				Result<T> decoded = decode<T>(message);
+				if (!decoded) return decoded.error_unchecked();
+				output[i] = std::move(*decoded);
+			}
+			return {};
+		}
+	}
+
+	/// Decode a ReadVars response into a buffer of the requested size.
+	template<typename T>
+	Error decodeReadVarsInto(std::string_view & message, T * output, std::size_t count) {
 		// Read a single value (data is exactly one element).
-		if (command.count == 1) {
-			Result<T> result = decodeReadVar<T>(message, {command.index});
-			if (!result) return result.error_unchecked();
-			return std::vector<T>{*result};
+		if (count == 1) {
+			if (auto error = expectSize( "response data", message.size(), encoded_size<T>())) return error;
+			return decodeValues(message, output, 1);
 		}
 
 		// Read multiple values (data starts with a 32 bit value count).
-		if (auto error = expectSize( "response data", message.size(), 4 + command.count * encoded_size<T>())) return error;
+		if (auto error = expectSize( "response data", message.size(), 4 + count * encoded_size<T>())) return error;
 
 		// Check if value count matches our request.
-		std::uint32_t count = readLittleEndian<std::uint32_t>(message);
-		if (auto error = expectValue("value count", count, command.count)) return error;
-
-		// Decode and return values.
-		std::vector<T> result;
-		result.reserve(command.count);
-		for (std::size_t i = 0; i < command.count; ++i) {
-			Result<T> decoded = decode<T>(message);
-			if (!decoded) return decoded.error_unchecked();
-			result.push_back(*decoded);
-		}
+		std::uint32_t actual_count = readLittleEndian<std::uint32_t>(message);
+		if (auto error = expectValue("value count", actual_count, count)) return error;
+
+		return decodeValues(message, output, count);
+	}
+
+	/// Decode a ReadVars response.
+	template<typename T>
+	Result<std::vector<T>> decodeReadVars(std::string_view & message, ReadVars<T> const & command) {
+		// Decoding overwrites the default constructed values in place.
+		static_assert(std::is_default_constructible<T>::value, "ReadVars<T> requires a default constructible T");
+		std::vector<T> result(command.count);
+		if (auto error = decodeReadVarsInto(message, result.data(), result.size())) return error;
 		return result;
 	}
 
+	/// Encode a ReadVarsInto command.
+	template<typename T>
+	void encodeReadVarsInto(std::vector<std::uint8_t> & output, std::uint8_t request_id, ReadVarsInto<T> const & command) {
+		if (command.output.size() < 1 || command.output.size() > 255) {
+			throw std::logic_error("ReadVarsInto: output size must be in the range [1, 255], got " + std::to_string(command.output.size()));
+		}
+		encodeReadVars(output, request_id, ReadVars<T>{command.index, std::uint8_t(command.output.size())});
+	}
+
+	/// Decode a ReadVarsInto response.
+	template<typename T>
+	Result<void> decodeReadVarsInto(std::string_view & message, ReadVarsInto<T> const & command) {
+		if (auto error = decodeReadVarsInto(message, command.output.data(), command.output.size())) return error;
+		return estd::in_place_valid;
+	}
+
 	/// Encode a WriteVar command.
 	template<typename T>
 	void encodeWriteVar(std::vector<std::uint8_t> & output, std::uint8_t request_id, WriteVar<T> const & command) {
-		encode(output, makeRobotRequestHeader(encoded_size<T>(), udp_command<WriteVar<T>>(), command.index, 0, service::set_all, request_id));
-		encode(output, command.value);
+		constexpr EncodedHeader header = makeHeaderTemplate(Division::robot, udp_command<WriteVar<T>>(), 0, service::set_all);
+		std::uint8_t * out = encodeHeader(extend(output, header_size + encoded_size<T>()), header, encoded_size<T>(), request_id, command.index);
+		encode(out, command.value);
 	}
 
 	/// Encode a WriteVars command.
@@ -239,16 +259,18 @@ namespace {
 		// Write a single value.
 		if (command.values.size() == 1) {
 			// Not delegating to WriteVar<T>, since that would require copying a T.
-			encode(output, makeRobotRequestHeader(encoded_size<T>(), udp_command<WriteVar<T>>(), command.index, 0, service::set_all, request_id));
-			encode(output, command.values[0]);
+			constexpr EncodedHeader header = makeHeaderTemplate(Division::robot, udp_command<WriteVar<T>>(), 0, service::set_all);
+			std::uint8_t * out = encodeHeader(extend(output, header_size + encoded_size<T>()), header, encoded_size<T>(), request_id, command.index);
+			encode(out, command.values[0]);
 			return;
 
 		// Write mutliple values.
 		} else {
 			std::uint32_t data_size = 4 + command.values.size() * encoded_size<T>();
-			encode(output, makeRobotRequestHeader(data_size, udp_command<WriteVars<T>>(), command.index, 0, service::write_multiple, request_id));
-			writeLittleEndian<std::uint32_t>(output, command.values.size());
-			for (auto const & val : command.values) encode(output, val);
+			constexpr EncodedHeader header = makeHeaderTemplate(Division::robot, udp_command<WriteVars<T>>(), 0, service::write_multiple);
+			std::uint8_t * out = encodeHeader(extend(output, header_size + data_size), header, data_size, request_id, command.index);
+			out = storeLittleEndian<std::uint32_t>(out, command.values.size());
+			for (auto const & val : command.values) out = encode(out, val);
 		}
 	}
 
@@ -270,12 +292,15 @@ namespace {
 #define DEFINE_VAR(TYPE) \
 void encode(std::vector<std::uint8_t> & out, std::uint8_t id, ReadVar<TYPE> const & cmd) { return encodeReadVar(out, id, cmd); } \
 void encode(std::vector<std::uint8_t> & out, std::uint8_t id, ReadVars<TYPE> const & cmd) { return encodeReadVars(out, id, cmd); } \
+void encode(std::vector<std::uint8_t> & out, std::uint8_t id, ReadVarsInto<TYPE> const & cmd) { return encodeReadVarsInto(out, id, cmd); } \
 void encode(std::vector<std::uint8_t> & out, std::uint8_t id, WriteVar<TYPE> const & cmd) { return encodeWriteVar(out, id, cmd); } \
 void encode(std::vector<std::uint8_t> & out, std::uint8_t id, WriteVars<TYPE> const & cmd) { return encodeWriteVars(out, id, cmd); } \
 Result<TYPE> decode(ResponseHeader const &, std::string_view & data, ReadVar<TYPE> const & cmd) { return decodeReadVar(data, cmd); } \
 Result<std::vector<TYPE>> decode(ResponseHeader const &, std::string_view & data,  ReadVars<TYPE> const & cmd) { return decodeReadVars  (data, cmd); } \
+Result<void> decode(ResponseHeader const &, std::string_view & data, ReadVarsInto<TYPE> const & cmd) { return decodeReadVarsInto(data, cmd); } \
 Result<void> decode(ResponseHeader const &, std::string_view & data, WriteVar<TYPE> const & cmd) { return decodeWriteVar(data, cmd); } \
-Result<void> decode(ResponseHeader const &, std::string_view & data, WriteVars<TYPE> const & cmd) { return decodeWriteVars(data, cmd); }
+Result<void> decode(ResponseHeader const &, std::string_view & data, WriteVars<TYPE> const & cmd) { return decodeWriteVars(data, cmd); } \
+void encodeValue(std::uint8_t * out, TYPE const & value) { encode(out, value); }
 
 DEFINE_VAR(std::uint8_t)
 DEFINE_VAR(std::int16_t)
@@ -287,31 +312,45 @@ DEFINE_VAR(Position)
 
 /// Encode a ReadFileList command.
 void encode(std::vector<std::uint8_t> & out, std::uint8_t request_id, ReadFileList const & command) {
-	encode(out, makeFileRequestHeader(command.type.size(), commands::file::read_file_list, request_id));
-	std::copy(command.type.begin(), command.type.end(), std::back_inserter(out));
+	constexpr EncodedHeader header = makeHeaderTemplate(Division::file, 0, 0, commands::file::read_file_list);
+	std::uint8_t * data = encodeHeader(extend(out, header_size + command.type.size()), header, command.type.size(), request_id);
+	std::memcpy(data, command.type.data(), command.type.size());
 }
 
 /// Decode a ReadFileList response.
-Result<std::vector<std::string>> decode(ResponseHeader const &, std::string && data, ReadFileList const &) {
-	if (data.size() == 0) return std::vector<std::string>{};
-	if (data.size() == 1) return malformedResponse("file list consist of exactly one byte");
-
-	auto line_start = data.begin();
-	auto finger     = line_start;
-	std::vector<std::string> result;
-	while (finger < data.end() - 1) {
-		if (finger[0] == '\r' && finger[1] == '\n') {
-			result.emplace_back(line_start, finger);
-			line_start = finger + 2;
+/**
+ * The names are separated by CRLF.
+ * The list is split in a single pass, keeping the names in the response buffer.
+ * Empty names are skipped, and a trailing name without CRLF is accepted.
+ */
+Result<FileList> decode(ResponseHeader const &, std::string && data, ReadFileList const &) {
+	std::vector<FileList::Range> names;
+	char const * begin = data.data();
+	char const * end   = begin + data.size();
+	char const * line  = begin;
+	char const * search = begin;
+
+	while (search < end) {
+		char const * cr = static_cast<char const *>(std::memchr(search, '\r', end - search));
+		if (!cr) break;
+		if (cr + 1 == end || cr[1] != '\n') {
+			search = cr + 1;
+			continue;
 		}
+		if (cr != line) names.push_back({std::uint32_t(line - begin), std::uint32_t(cr - begin)});
+		line   = cr + 2;
+		search = line;
 	}
-	return result;
+	if (line != end) names.push_back({std::uint32_t(line - begin), std::uint32_t(end - begin)});
+
+	return FileList{std::move(data), std::move(names)};
 }
 
 /// Encode a ReadFile command.
 void encode(std::vector<std::uint8_t> & out, std::uint8_t request_id, ReadFile const & command) {
-	encode(out, makeFileRequestHeader(command.name.size(), commands::file::read_file, request_id));
-	out.insert(out.end(), command.name.begin(), command.name.end());
+	constexpr EncodedHeader header = makeHeaderTemplate(Division::file, 0, 0, commands::file::read_file);
+	std::uint8_t * data = encodeHeader(extend(out, header_size + command.name.size()), header, command.name.size(), request_id);
+	std::memcpy(data, command.name.data(), command.name.size());
 }
 
 /// Decode a ReadFile response.
@@ -319,10 +358,28 @@ Result<std::string> decode(ResponseHeader const &, std::string && data, ReadFile
 	return std::move(data);
 }
 
+/// Encode a ReadFileStreaming command.
+/**
+ * The blocks of the response are passed to the sink by the read session, so there is no decode function.
+ */
+void encode(std::vector<std::uint8_t> & out, std::uint8_t request_id, ReadFileStreaming const & command) {
+	constexpr EncodedHeader header = makeHeaderTemplate(Division::file, 0, 0, commands::file::read_file);
+	std::uint8_t * data = encodeHeader(extend(out, header_size + command.name.size()), header, command.name.size(), request_id);
+	std::memcpy(data, command.name.data(), command.name.size());
+}
+
 /// Encode a WriteFile command.
 void encode(std::vector<std::uint8_t> & out, std::uint8_t request_id, WriteFile const & command) {
-	encode(out, makeFileRequestHeader(command.name.size(), commands::file::write_file, request_id));
-	out.insert(out.end(), command.name.begin(), command.name.end());
+	constexpr EncodedHeader header = makeHeaderTemplate(Division::file, 0, 0, commands::file::write_file);
+	std::uint8_t * data = encodeHeader(extend(out, header_size + command.name.size()), header, command.name.size(), request_id);
+	std::memcpy(data, command.name.data(), command.name.size());
+}
+
+/// Encode a WriteFileView command.
+void encode(std::vector<std::uint8_t> & out, std::uint8_t request_id, WriteFileView const & command) {
+	constexpr EncodedHeader header = makeHeaderTemplate(Division::file, 0, 0, commands::file::write_file);
+	std::uint8_t * data = encodeHeader(extend(out, header_size + command.name.size()), header, command.name.size(), request_id);
+	std::memcpy(data, command.name.data(), command.name.size());
 }
 
 /// Decode a WriteFile response.
@@ -333,8 +390,9 @@ Result<void> decode(ResponseHeader const &, std::string_view & data, WriteFile c
 
 /// Encode a DeleteFile command.
 void encode(std::vector<std::uint8_t> & out, std::uint8_t request_id, DeleteFile const & command) {
-	encode(out, makeFileRequestHeader(command.name.size(), commands::file::delete_file, request_id));
-	out.insert(out.end(), command.name.begin(), command.name.end());
+	constexpr EncodedHeader header = makeHeaderTemplate(Division::file, 0, 0, commands::file::delete_file);
+	std::uint8_t * data = encodeHeader(extend(out, header_size + command.name.size()), header, command.name.size(), request_id);
+	std::memcpy(data, command.name.data(), command.name.size());
 }
 
 /// Decode a DeleteFile response.
@@ -33,15 +33,17 @@
 #include "encode.hpp"
 #include "decode.hpp"
 
-#include <asio/steady_timer.hpp>
-
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <functional>
+#include <map>
 #include <memory>
+#include <string>
 #include <string_view>
 #include <system_error>
+#include <type_traits>
 #include <utility>
 
 namespace dr {
@@ -49,6 +51,20 @@ namespace yaskawa {
 namespace udp {
 namespace impl {
 
+/// Session to download a file from the controller.
+/**
+ * The controller sends the file one block at a time and waits for an ack before sending the next block.
+ * To keep that pipeline moving, the session:
+ * - acks every block as soon as it arrives, before processing it;
+ * - acks duplicate blocks again, since a duplicate means the previous ack was lost;
+ * - repeats the last ack if the next block takes much longer to arrive than the blocks before it,
+ *   so a lost ack costs a few block intervals instead of the retransmission timeout of the controller;
+ * - keeps blocks that arrive ahead of a missing block, and appends them once the gap is filled;
+ * - keeps acking repeats of the last block for a while after the download finished,
+ *   since the controller sends the last block again if its ack was lost.
+ *
+ * For ReadFileStreaming the blocks are passed to the sink of the command instead of being collected in memory.
+ */
 template<typename Command>
 class ReadFileSession : public std::enable_shared_from_this<ReadFileSession<Command>> {
 	using Response         = typename Command::Response;
@@ -56,11 +72,27 @@ class ReadFileSession : public std::enable_shared_from_this<ReadFileSession<Comm
 	using ProgressCallback = std::function<void(std::size_t bytes_received)>;
 
 public:
+	/// Minimum time to wait for the next block before repeating the last ack.
+	static constexpr std::chrono::milliseconds min_ack_repeat_interval{10};
+
+	/// Maximum time to wait for the next block before repeating the last ack.
+	static constexpr std::chrono::milliseconds max_ack_repeat_interval{200};
+
+	/// Time to keep acking repeats of the last block after the download finished.
+	static constexpr std::chrono::milliseconds last_block_linger{1000};
+
+	/// Maximum number of blocks to keep that arrived ahead of a missing block.
+	static constexpr std::uint32_t max_blocks_ahead = 64;
+
+	/// If true, the data is passed to the sink of the command instead of being collected.
+	static constexpr bool streaming = std::is_same_v<Command, ReadFileStreaming>;
+
 	Client * client_;
 	std::uint8_t request_id_;
 	Command command_;
 	Client::HandlerToken handler_;
-	asio::steady_timer timer_;
+	SteadyTimer timer_;
+	SteadyTimer ack_timer_;
 	std::chrono::milliseconds timeout_;
 	std::vector<std::uint8_t> write_buffer_;
 	std::string read_buffer_;
@@ -69,7 +101,21 @@ public:
 	ProgressCallback on_progress_;
 
 	std::atomic_bool done_{false};
-	std::size_t blocks_received_ = 0;
+	bool last_block_received_ = false;
+	std::uint32_t blocks_received_ = 0;
+	std::size_t bytes_received_ = 0;
+
+	/// The block number (without the last-block flag) of the last in-order block that was acked.
+	std::uint32_t last_ack_ = 0;
+
+	/// Arrival time of the last block.
+	std::chrono::steady_clock::time_point last_block_time_;
+
+	/// Smoothed time between the arrival of two blocks, or zero if not known yet.
+	std::chrono::steady_clock::duration block_interval_{0};
+
+	/// Blocks that arrived ahead of a missing block, with their last-block flag.
+	std::map<std::uint32_t, std::pair<std::string, bool>> blocks_ahead_;
 
 public:
 	/// Construct a command session.
@@ -85,11 +131,12 @@ public:
 		request_id_{request_id},
 		command_{std::move(command)},
 		timer_(client.get_executor()),
+		ack_timer_(client.get_executor()),
 		timeout_{timeout},
 		on_done_(std::move(on_done)),
 		on_progress_(std::move(on_progress))
 	{
-		read_buffer_.reserve(1024);
+		if (!streaming) read_buffer_.reserve(1024);
 
 		// Encode the command.
 		encode(write_buffer_, request_id, command_);
@@ -102,8 +149,8 @@ public:
 		});
 
 		// Send the command.
-		client_->socket().async_send(asio::buffer(write_buffer_.data(), write_buffer_.size()), [this, self = self()] (std::error_code error, std::size_t) {
-			if (error) return stopSession(Error(error, "writing command for request " + std::to_string(request_id_)));
+		client_->send(asio::buffer(write_buffer_.data(), write_buffer_.size()), [this, self = self()] (std::error_code error) {
+			stopSession(Error(error, "writing command for request " + std::to_string(request_id_)));
 		});
 
 		// Start the timeout.
@@ -118,8 +165,42 @@ protected:
 	void writeAck(std::uint32_t block_number) {
 		auto buffer = std::make_shared<std::vector<std::uint8_t>>();
 		encode(*buffer, makeFileRequestHeader(0, commands::file::read_file, request_id_, block_number, true));
-		client_->socket().async_send(asio::buffer(*buffer), [this, self = self(), buffer = std::move(buffer)] (std::error_code error, std::size_t) {
-			if (error) return stopSession(Error(error, "writing ack for request " + std::to_string(request_id_)));
+		asio::const_buffer message = asio::buffer(*buffer);
+		client_->send(message, [this, self = self(), buffer = std::move(buffer)] (std::error_code error) {
+			stopSession(Error(error, "writing ack for request " + std::to_string(request_id_)));
+		});
+	}
+
+	/// Write an ack for a repeat of the last block, after the session has finished.
+	/**
+	 * Does not refer to the session, which may be gone by then.
+	 */
+	static void writeLateAck(Client & client, std::uint8_t request_id, std::uint32_t block_number) {
+		auto buffer = std::make_shared<std::vector<std::uint8_t>>();
+		encode(*buffer, makeFileRequestHeader(0, commands::file::read_file, request_id, block_number, true));
+		asio::const_buffer message = asio::buffer(*buffer);
+		client.send(message, [buffer = std::move(buffer)] (std::error_code) {});
+	}
+
+	/// Update the smoothed block interval with the arrival of a new block.
+	void updateBlockInterval() {
+		auto now = std::chrono::steady_clock::now();
+		if (blocks_received_ > 0) {
+			auto sample = now - last_block_time_;
+			block_interval_ = block_interval_.count() ? (7 * block_interval_ + sample) / 8 : sample;
+		}
+		last_block_time_ = now;
+	}
+
+	/// Repeat the last ack if the next block doesn't arrive in time.
+	void scheduleAckRepeat() {
+		std::chrono::steady_clock::duration interval = max_ack_repeat_interval;
+		if (block_interval_.count()) interval = std::clamp<std::chrono::steady_clock::duration>(4 * block_interval_, min_ack_repeat_interval, max_ack_repeat_interval);
+		ack_timer_.expires_from_now(interval);
+		ack_timer_.async_wait([this, self = self()] (std::error_code error) {
+			if (error || done_.load()) return;
+			writeAck(last_ack_);
+			scheduleAckRepeat();
 		});
 	}
 
@@ -128,16 +209,58 @@ protected:
 		if (done_.load()) return;
 		if (header.status != 0) return stopSession(commandFailed(header.status, header.extra_status));
 
-		std::size_t block = header.block_number & 0x7fffffff;
+		std::uint32_t block = header.block_number & 0x7fffffff;
 		bool last_block = header.block_number & 0x80000000;
 
-		if (auto error = expectValue("block number", block, blocks_received_ + 1)) return stopSession(error);
+		// Ack right away, even for duplicates: the controller is waiting for it.
 		writeAck(block);
 
-		read_buffer_.insert(read_buffer_.end(), data.begin(), data.end());
+		// Duplicate of a block we already have, the previous ack must have been lost.
+		if (block <= blocks_received_) return;
+
+		if (block > blocks_received_ + 1) {
+			if (auto error = expectValueMax("block number", block, blocks_received_ + max_blocks_ahead)) return stopSession(error);
+			blocks_ahead_.emplace(block, std::make_pair(std::string(data), last_block));
+			return;
+		}
 
-		if (on_progress_) on_progress_(read_buffer_.size());
-		if (last_block) stopSession(decode(header, std::move(read_buffer_), command_));
+		updateBlockInterval();
+		last_ack_ = block;
+		if (appendBlock(data, last_block)) return;
+
+		// Append blocks that were waiting for this one.
+		while (!blocks_ahead_.empty() && blocks_ahead_.begin()->first == blocks_received_ + 1) {
+			auto node = blocks_ahead_.extract(blocks_ahead_.begin());
+			last_ack_ = node.key();
+			if (appendBlock(node.mapped().first, node.mapped().second)) return;
+		}
+
+		scheduleAckRepeat();
+	}
+
+	/// Append the next block to the file data, or pass it to the sink.
+	/**
+	 * \return True if this was the last block and the session is finished.
+	 */
+	bool appendBlock(std::string_view data, bool last_block) {
+		++blocks_received_;
+		bytes_received_ += data.size();
+		if (last_block) last_block_received_ = true;
+		if constexpr (streaming) {
+			Result<void> result = command_.sink(data);
+			if (!result) {
+				stopSession(std::move(result));
+				return true;
+			}
+		} else {
+			read_buffer_.append(data.begin(), data.end());
+		}
+		if (on_progress_) on_progress_(bytes_received_);
+		if (!last_block) return false;
+
+		if constexpr (streaming) stopSession(estd::in_place_valid);
+		else stopSession(decode(ResponseHeader{}, std::move(read_buffer_), command_));
+		return true;
 	}
 
 	void resetTimeout() {
@@ -145,6 +268,7 @@ protected:
 		timer_.async_wait([this, self = self()] (std::error_code error) {
 			if (error == asio::error::operation_aborted) return;
 			if (error) return stopSession(Error(error, "waiting for reply to request " + std::to_string(request_id_)));
+			if (!done_.load()) client_->recordTimeout(request_id_);
 			stopSession(Error(std::errc::timed_out, "waiting for reply to request " + std::to_string(request_id_)));
 		});
 	}
@@ -152,7 +276,16 @@ protected:
 	void stopSession(Result<Response> result) {
 		if (done_.exchange(true)) return;
 		timer_.cancel();
-		client_->removeHandler(handler_);
+		ack_timer_.cancel();
+
+		// The ack of the last block may get lost, so keep acking the controller when it sends the last block again.
+		if (last_block_received_) {
+			client_->lingerHandler(handler_, last_block_linger, [client = client_, request_id = request_id_] (ResponseHeader const & header, std::string_view) {
+				if (header.status == 0) writeLateAck(*client, request_id, header.block_number & 0x7fffffff);
+			});
+		} else {
+			client_->removeHandler(handler_);
+		}
 		return on_done_(result);
 	}
 };
@@ -0,0 +1,128 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "udp/client.hpp"
+#include "udp/message.hpp"
+
+#include <asio/buffer.hpp>
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <system_error>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+namespace impl {
+
+/// Buffers to read a batch of pending datagrams from a socket in one go.
+/**
+ * On Linux the whole batch is read with a single recvmmsg() call.
+ * Elsewhere the socket is drained with one receive per datagram,
+ * as long as the socket reports available data.
+ */
+class ReceiveBatch {
+public:
+	/// Maximum number of datagrams in a batch.
+	static constexpr std::size_t max_messages = 16;
+
+	/// Size of a receive buffer, enough for the largest message of the protocol.
+	static constexpr std::size_t buffer_size = 512;
+	static_assert(buffer_size >= header_size + max_payload_size, "receive buffer too small for the largest message");
+
+private:
+	/// The receive buffers.
+	std::array<std::array<std::uint8_t, buffer_size>, max_messages> buffers_;
+
+	/// The size of the datagram in each buffer.
+	std::array<std::size_t, max_messages> sizes_{};
+
+#ifdef __linux__
+	/// Message headers for recvmmsg, pointing to the receive buffers.
+	std::array<mmsghdr, max_messages> headers_{};
+
+	/// IO vectors for the message headers.
+	std::array<iovec, max_messages> vectors_{};
+#endif
+
+public:
+	ReceiveBatch() {
+#ifdef __linux__
+		for (std::size_t i = 0; i < max_messages; ++i) {
+			vectors_[i].iov_base = buffers_[i].data();
+			vectors_[i].iov_len  = buffer_size;
+			headers_[i].msg_hdr.msg_iov    = &vectors_[i];
+			headers_[i].msg_hdr.msg_iovlen = 1;
+		}
+#endif
+	}
+
+	ReceiveBatch(ReceiveBatch const &) = delete;
+	ReceiveBatch & operator=(ReceiveBatch const &) = delete;
+
+	/// Read pending datagrams without blocking.
+	/**
+	 * \return The number of datagrams read.
+	 * If no data was pending, this is zero and error is not set.
+	 */
+	std::size_t read(Client::Socket & socket, std::error_code & error) {
+#ifdef __linux__
+		int count = ::recvmmsg(socket.native_handle(), headers_.data(), max_messages, MSG_DONTWAIT, nullptr);
+		if (count < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) error = std::error_code{errno, std::system_category()};
+			return 0;
+		}
+		for (int i = 0; i < count; ++i) sizes_[i] = headers_[i].msg_len;
+		return count;
+#else
+		std::size_t count = 0;
+		while (count < max_messages && socket.available(error) > 0 && !error) {
+			sizes_[count] = socket.receive(asio::buffer(buffers_[count]), 0, error);
+			if (error) break;
+			++count;
+		}
+		return count;
+#endif
+	}
+
+	/// Get a datagram from the last read batch.
+	std::string_view message(std::size_t index) const {
+		return {reinterpret_cast<char const *>(buffers_[index].data()), sizes_[index]};
+	}
+};
+
+}}}}
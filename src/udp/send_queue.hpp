@@ -0,0 +1,183 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+#include "udp/client.hpp"
+
+#include <asio/buffer.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <functional>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+namespace impl {
+
+/// Queue of outgoing datagrams, sent in batches.
+/**
+ * On Linux a batch is sent with a single sendmmsg() call.
+ * Elsewhere each datagram is sent with its own send() call.
+ */
+class SendQueue {
+public:
+	/// Maximum number of datagrams sent with one system call.
+	static constexpr std::size_t max_batch = 64;
+
+	/// A queued datagram.
+	struct Message {
+		/// The data of the datagram: a header and an optional payload.
+		std::array<asio::const_buffer, 2> buffers;
+
+		/// Called if sending the datagram failed.
+		std::function<void(std::error_code)> on_error;
+
+		/// The owner of the buffers, used to cancel the message, or null.
+		void const * owner = nullptr;
+	};
+
+private:
+	/// The queued messages.
+	std::vector<Message> queue_;
+
+	/// Index of the first message in the queue that has not been sent yet.
+	std::size_t next_ = 0;
+
+#ifdef __linux__
+	/// Message headers for sendmmsg.
+	std::array<mmsghdr, max_batch> headers_{};
+
+	/// IO vectors for the message headers, two per message.
+	std::array<iovec, 2 * max_batch> vectors_{};
+#endif
+
+public:
+	SendQueue() {
+		queue_.reserve(256);
+	}
+
+	SendQueue(SendQueue const &) = delete;
+	SendQueue & operator=(SendQueue const &) = delete;
+
+	/// Add a message to the queue.
+	void push(Message message) {
+		queue_.push_back(std::move(message));
+	}
+
+	/// Remove all unsent messages of an owner, without invoking their error callbacks.
+	/**
+	 * May be called from an error callback invoked by the queue.
+	 */
+	void cancel(void const * owner) {
+		if (!owner) return;
+		auto unsent = queue_.begin() + next_;
+		queue_.erase(std::remove_if(unsent, queue_.end(), [owner] (Message const & message) {
+			return message.owner == owner;
+		}), queue_.end());
+	}
+
+	/// Check if there are messages waiting to be sent.
+	bool empty() const {
+		return next_ == queue_.size();
+	}
+
+	/// Send all queued messages without blocking.
+	/**
+	 * Messages that fail to send are removed from the queue and their error callback is invoked.
+	 * Error callbacks may queue new messages, which are sent in the same flush.
+	 *
+	 * \return False if the socket would block before all messages were sent, true otherwise.
+	 */
+	bool flush(Client::Socket & socket) {
+		while (!empty()) {
+#ifdef __linux__
+			std::size_t count = std::min(max_batch, queue_.size() - next_);
+			for (std::size_t i = 0; i < count; ++i) {
+				Message const & message = queue_[next_ + i];
+				for (std::size_t j = 0; j < 2; ++j) {
+					vectors_[2 * i + j].iov_base = const_cast<void *>(message.buffers[j].data());
+					vectors_[2 * i + j].iov_len  = message.buffers[j].size();
+				}
+				headers_[i].msg_hdr.msg_iov    = &vectors_[2 * i];
+				headers_[i].msg_hdr.msg_iovlen = message.buffers[1].size() ? 2 : 1;
+			}
+
+			int sent = ::sendmmsg(socket.native_handle(), headers_.data(), count, MSG_DONTWAIT);
+			if (sent >= 0) {
+				next_ += sent;
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+			fail(std::error_code{errno, std::system_category()});
+#else
+			std::error_code error;
+			Message const & message = queue_[next_];
+			socket.send(message.buffers, 0, error);
+			if (error) fail(error);
+			else ++next_;
+#endif
+		}
+
+		clear();
+		return true;
+	}
+
+	/// Remove all queued messages and invoke their error callbacks.
+	void failAll(std::error_code error) {
+		while (!empty()) fail(error);
+		clear();
+	}
+
+private:
+	/// Remove the first unsent message and invoke its error callback.
+	void fail(std::error_code error) {
+		// The callback may queue new messages, so move it out first.
+		std::function<void(std::error_code)> on_error = std::move(queue_[next_].on_error);
+		++next_;
+		if (on_error) on_error(error);
+	}
+
+	/// Remove all sent messages.
+	void clear() {
+		queue_.clear();
+		next_ = 0;
+	}
+};
+
+}}}}
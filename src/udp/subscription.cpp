@@ -0,0 +1,282 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "udp/subscription.hpp"
+#include "udp/protocol.hpp"
+#include "udp/impl/send_multiple_commands.hpp"
+#include "udp/impl/session_pool.hpp"
+#include "error.hpp"
+
+#include <asio/buffer.hpp>
+#include <asio/dispatch.hpp>
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+bool SubscriptionSnapshot::sameValues(SubscriptionSnapshot const & other) const {
+	return status == other.status
+		&& position      == other.position
+		&& uint8_vars    == other.uint8_vars
+		&& int16_vars    == other.int16_vars
+		&& int32_vars    == other.int32_vars
+		&& float_vars    == other.float_vars
+		&& position_vars == other.position_vars;
+}
+
+Subscription::Subscription(Client & client, SubscriptionOptions options) :
+	client_{&client},
+	options_{std::move(options)},
+	timer_{client.get_executor()}
+{
+	if (options_.status) {
+		packets_.push_back({
+			[] (std::vector<std::uint8_t> & output, std::uint8_t request_id) {
+				encode(output, request_id, ReadStatus{});
+			},
+			{},
+			[] (ResponseHeader const & header, std::string_view data, SubscriptionSnapshot & snapshot) -> Error {
+				Result<Status> status = decode(header, data, ReadStatus{});
+				if (!status) return status.error_unchecked();
+				snapshot.status = *status;
+				return {};
+			},
+		});
+	}
+
+	if (options_.position) {
+		ReadCurrentPosition command = *options_.position;
+		packets_.push_back({
+			[command] (std::vector<std::uint8_t> & output, std::uint8_t request_id) {
+				encode(output, request_id, command);
+			},
+			{},
+			[command] (ResponseHeader const & header, std::string_view data, SubscriptionSnapshot & snapshot) -> Error {
+				Result<Position> position = decode(header, data, command);
+				if (!position) return position.error_unchecked();
+				snapshot.position = *position;
+				return {};
+			},
+		});
+	}
+
+	addVariables(options_.uint8_vars,    &SubscriptionSnapshot::uint8_vars);
+	addVariables(options_.int16_vars,    &SubscriptionSnapshot::int16_vars);
+	addVariables(options_.int32_vars,    &SubscriptionSnapshot::int32_vars);
+	addVariables(options_.float_vars,    &SubscriptionSnapshot::float_vars);
+	addVariables(options_.position_vars, &SubscriptionSnapshot::position_vars);
+
+	if (packets_.empty()) throw std::logic_error("Subscription: nothing selected to read");
+}
+
+Subscription::~Subscription() {
+	if (running_) stopNow();
+}
+
+template<typename T>
+void Subscription::addVariables(VariableRange range, std::vector<T> SubscriptionSnapshot::* values) {
+	if (range.count == 0) return;
+	if (range.index + range.count > 256) {
+		throw std::logic_error("Subscription: variable range [" + std::to_string(range.index) + ", "
+			+ std::to_string(range.index + range.count) + ") exceeds the maximum variable index 255");
+	}
+
+	for (SubscriptionSnapshot & buffer : buffers_) (buffer.*values).resize(range.count);
+
+	// Split the range in chunks that fit in a single message.
+	// The controller rejects reads of an odd number of B variables,
+	// so those chunks are even sized and an odd remainder is padded with a neighbouring variable that is discarded.
+	constexpr bool even_count = impl::coalesce_traits<ReadVar<T>>::even_count;
+	constexpr std::size_t chunk_size = even_count ? impl::max_coalesced_count<T> & ~std::size_t(1) : impl::max_coalesced_count<T>;
+	for (std::size_t offset = 0; offset < range.count; offset += chunk_size) {
+		std::uint8_t index = range.index + offset;
+		std::uint8_t count = std::min(range.count - offset, chunk_size);
+		std::uint8_t read_index = index;
+		std::uint8_t read_count = count;
+		if (even_count && count % 2) {
+			++read_count;
+			if (index + read_count > 256) --read_index;
+		}
+
+		packets_.push_back({
+			[read_index, read_count] (std::vector<std::uint8_t> & output, std::uint8_t request_id) {
+				encode(output, request_id, ReadVars<T>{read_index, read_count});
+			},
+			{},
+			[index, count, read_index, read_count, offset, values] (ResponseHeader const & header, std::string_view data, SubscriptionSnapshot & snapshot) -> Error {
+				T * output = (snapshot.*values).data() + offset;
+				if (read_count == count) {
+					Result<void> result = decode(header, data, ReadVarsInto<T>{index, {output, count}});
+					if (!result) return result.error_unchecked();
+					return {};
+				}
+
+				std::array<T, chunk_size> padded;
+				Result<void> result = decode(header, data, ReadVarsInto<T>{read_index, {padded.data(), read_count}});
+				if (!result) return result.error_unchecked();
+				std::copy_n(padded.begin() + (index - read_index), count, output);
+				return {};
+			},
+		});
+	}
+}
+
+void Subscription::start() {
+	asio::dispatch(client_->get_executor(), impl::poolHandler(client_->sessionPool(), [this] () {
+		startNow();
+	}));
+}
+
+void Subscription::stop() {
+	asio::dispatch(client_->get_executor(), impl::poolHandler(client_->sessionPool(), [this] () {
+		if (running_) stopNow();
+	}));
+}
+
+void Subscription::startNow() {
+	if (running_) return;
+
+	// The request IDs stay allocated while the subscription runs, so the requests only need to be encoded once.
+	Result<std::uint8_t> first_id = client_->allocateIds(packets_.size());
+	if (!first_id) {
+		if (on_error) on_error(first_id.error_unchecked());
+		return;
+	}
+	first_id_ = *first_id;
+
+	for (std::size_t i = 0; i < packets_.size(); ++i) {
+		std::uint8_t request_id = first_id_ + i;
+		packets_[i].message.clear();
+		packets_[i].encode(packets_[i].message, request_id);
+		client_->registerHandler(request_id, [this, i] (ResponseHeader const & header, std::string_view data) {
+			onResponse(i, header, data);
+		});
+	}
+
+	running_    = true;
+	pending_    = 0;
+	next_cycle_ = std::chrono::steady_clock::now();
+	startCycle();
+}
+
+void Subscription::stopNow() {
+	running_ = false;
+	pending_ = 0;
+	timer_.cancel();
+	client_->cancelSends(this);
+	for (std::size_t i = 0; i < packets_.size(); ++i) {
+		client_->removeHandler(std::uint8_t(first_id_ + i));
+	}
+}
+
+void Subscription::scheduleCycle() {
+	next_cycle_ += options_.period;
+
+	// If we fell behind, skip the cycles that can no longer start on time.
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (next_cycle_ < now) next_cycle_ += ((now - next_cycle_) / options_.period + 1) * options_.period;
+
+	timer_.expires_at(next_cycle_);
+	timer_.async_wait(impl::poolHandler(client_->sessionPool(), [this] (std::error_code error) {
+		if (error || !running_) return;
+		startCycle();
+	}));
+}
+
+void Subscription::startCycle() {
+	if (pending_ > 0) {
+		++missed_cycles_;
+		if (on_error) on_error(Error{std::errc::timed_out, "poll cycle " + std::to_string(cycles_) + " is missing "
+			+ std::to_string(pending_) + " of " + std::to_string(packets_.size()) + " responses"
+		});
+
+		// The error handler may have stopped us, in which case the request IDs are no longer ours.
+		if (!running_) return;
+	}
+
+	++cycles_;
+	SubscriptionSnapshot & back = buffers_[1 - front_];
+	back.cycle    = cycles_;
+	back.time     = next_cycle_;
+	pending_      = packets_.size();
+	cycle_failed_ = false;
+
+	for (std::size_t i = 0; i < packets_.size(); ++i) {
+		Packet & packet = packets_[i];
+		packet.received = false;
+
+		// The same request ID is used every cycle, but an unanswered poll is not retransmitted by this one.
+		client_->beginRequest(std::uint8_t(first_id_ + i));
+		client_->send(asio::buffer(packet.message.data(), packet.message.size()), [this] (std::error_code error) {
+			if (running_ && on_error) on_error(Error{error, "sending poll request"});
+		}, this);
+	}
+
+	scheduleCycle();
+}
+
+void Subscription::onResponse(std::size_t index, ResponseHeader const & header, std::string_view data) {
+	Packet & packet = packets_[index];
+	if (packet.received) return;
+	packet.received = true;
+	--pending_;
+
+	Error error;
+	if (header.status != 0) {
+		error = commandFailed(header.status, header.extra_status);
+	} else {
+		error = packet.decode(header, data, buffers_[1 - front_]);
+	}
+
+	if (error) {
+		cycle_failed_ = true;
+		if (on_error) on_error(std::move(error));
+		if (!running_) return;
+	}
+
+	if (pending_ == 0) finishCycle();
+}
+
+void Subscription::finishCycle() {
+	if (cycle_failed_) return;
+
+	SubscriptionSnapshot & back = buffers_[1 - front_];
+	if (published_ && back.sameValues(buffers_[front_])) return;
+
+	front_     = 1 - front_;
+	published_ = true;
+	if (on_change) on_change(buffers_[front_]);
+}
+
+}}}
@@ -0,0 +1,87 @@
+/* Copyright 2016-2019 Fizyr B.V. - https://fizyr.com
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software without
+ *    specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "udp/trace.hpp"
+
+#include <algorithm>
+#include <ostream>
+
+namespace dr {
+namespace yaskawa {
+namespace udp {
+
+char const * toString(TraceEvent event) {
+	switch (event) {
+		case TraceEvent::send:     return "send";
+		case TraceEvent::receive:  return "receive";
+		case TraceEvent::dispatch: return "dispatch";
+		case TraceEvent::decode:   return "decode";
+		case TraceEvent::timeout:  return "timeout";
+		case TraceEvent::resolve:  return "resolve";
+	}
+	return "unknown";
+}
+
+std::vector<TraceRecord> TraceRecorder::records() const {
+	std::vector<TraceRecord> result;
+	result.reserve(size());
+	std::size_t first = recorded_ < records_.size() ? 0 : next_;
+	for (std::size_t i = 0; i < size(); ++i) result.push_back(records_[(first + i) % records_.size()]);
+	return result;
+}
+
+void TraceRecorder::writeChromeTrace(std::ostream & out) const {
+	std::vector<TraceRecord> records = this->records();
+
+	// Spanning events are recorded when they end, so the oldest record doesn't necessarily start first.
+	std::chrono::steady_clock::time_point origin = records.empty() ? std::chrono::steady_clock::time_point{} : records.front().start;
+	for (TraceRecord const & record : records) origin = std::min(origin, record.start);
+
+	auto microseconds = [] (std::chrono::steady_clock::duration duration) {
+		return std::chrono::duration<double, std::micro>(duration).count();
+	};
+
+	out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+	bool first = true;
+	for (TraceRecord const & record : records) {
+		bool instant = record.start == record.end;
+		out << (first ? "\n" : ",\n")
+			<< "{\"name\": \"" << toString(record.event) << "\""
+			<< ", \"cat\": \"" << (record.command.division == Division::file ? "file" : "robot") << "\""
+			<< ", \"ph\": \"" << (instant ? "i" : "X") << "\""
+			<< ", \"ts\": " << microseconds(record.start - origin);
+		if (instant) out << ", \"s\": \"t\"";
+		else out << ", \"dur\": " << microseconds(record.end - record.start);
+		out << ", \"pid\": 1, \"tid\": " << int(record.request_id)
+			<< ", \"args\": {\"request_id\": " << int(record.request_id) << ", \"command\": " << record.command.command << "}}";
+		first = false;
+	}
+	out << "\n]}\n";
+}
+
+}}}
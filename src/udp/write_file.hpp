@@ -30,12 +30,12 @@
 #include "error.hpp"
 #include "udp/client.hpp"
 #include "udp/protocol.hpp"
+#include "udp/retransmit.hpp"
 #include "encode.hpp"
 #include "decode.hpp"
 
-#include <asio/steady_timer.hpp>
-
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <cstdint>
 #include <functional>
@@ -49,12 +49,16 @@ namespace yaskawa {
 namespace udp {
 namespace impl {
 
-/// Class representing a command session.
+/// Class representing a file upload session.
 /**
  * The session consists of the following actions:
- * - Write command and data.
- * - Read command response.
- * - Read response data.
+ * - Write the command with the file name.
+ * - Write the file data block by block, waiting for an ack of each block before writing the next.
+ *
+ * A message that is not acknowledged within the retransmission timeout is sent again,
+ * up to a configurable number of times per message.
+ * The retransmission timeout is derived from the measured round trip time of the acks.
+ * Duplicate acks for blocks that were already acknowledged are ignored.
  */
 template<typename Command>
 class WriteFileSession : public std::enable_shared_from_this<WriteFileSession<Command>> {
@@ -63,25 +67,48 @@ class WriteFileSession : public std::enable_shared_from_this<WriteFileSession<Co
 
 	Client * client_;
 	std::uint8_t request_id_;
-	WriteFile command_;
+	Command command_;
 	Client::HandlerToken handler_;
-	asio::steady_timer timer_;
+	SteadyTimer timer_;
+	SteadyTimer retransmit_timer_;
 	std::chrono::milliseconds timeout_;
 	std::vector<std::uint8_t> write_buffer_;
 
+	/// Encoded headers for data blocks, used alternately by odd and even blocks.
+	/**
+	 * Only one block is in flight at a time, but a retransmission of the previous block
+	 * may still be waiting in the send queue when the next block is sent.
+	 */
+	std::array<EncodedHeader, 2> block_headers_;
+
 	DoneCallback on_done_;
 	ProgressCallback on_progress_;
 
 	std::atomic_bool done_{false};
-	std::size_t blocks_sent_ = 0;
+
+	/// The total number of data blocks in the file.
+	std::uint32_t total_blocks_;
+
+	/// The number of the message in flight. Block 0 is the command itself.
+	std::uint32_t current_block_ = 0;
+
+	/// The number of times the message in flight has been retransmitted.
+	unsigned int retries_ = 0;
+
+	/// The time the message in flight was last sent.
+	std::chrono::steady_clock::time_point send_time_;
+
+	/// Round trip time estimator for the retransmission timeout.
+	RttEstimator rtt_;
 
 public:
 	/// Construct a command session.
 	WriteFileSession(
 		Client & client,
 		std::uint8_t request_id,
-		WriteFile command,
+		Command command,
 		std::chrono::milliseconds timeout,
+		RetransmitOptions const & retransmit,
 		DoneCallback on_done,
 		ProgressCallback on_progress = nullptr
 	) :
@@ -89,10 +116,15 @@ public:
 		request_id_{request_id},
 		command_{std::move(command)},
 		timer_(client.get_executor()),
+		retransmit_timer_(client.get_executor()),
 		timeout_{timeout},
 		on_done_(std::move(on_done)),
-		on_progress_(std::move(on_progress))
-	{}
+		on_progress_(std::move(on_progress)),
+		rtt_{retransmit}
+	{
+		// An empty file is still sent as a single (empty) last block.
+		total_blocks_ = std::max<std::size_t>(1, (command_.data.size() + max_payload_size - 1) / max_payload_size);
+	}
 
 	void start() {
 		// Encode the command.
@@ -104,44 +136,61 @@ public:
 		});
 
 		// Send the command.
-		client_->socket().async_send(asio::buffer(write_buffer_.data(), write_buffer_.size()), [this, self = self()] (std::error_code error, std::size_t) {
-			if (done_.load()) return;
-			if (error) return stopSession(Error{error, "writing command for request " + std::to_string(request_id_)});
-		});
+		sendCurrentBlock();
 
 		// Start the timeout.
 		resetTimeout();
 	}
 
 protected:
-	std::size_t bytesSent() const {
-		return std::min(blocks_sent_ * max_payload_size, command_.data.size());
+	/// Get the number of bytes acknowledged by the controller.
+	std::size_t bytesAcked() const {
+		if (current_block_ == 0) return 0;
+		return std::min((current_block_ - 1) * max_payload_size, command_.data.size());
 	}
 
 	/// Get a shared pointer to this session.
 	std::shared_ptr<WriteFileSession> self() { return this->shared_from_this(); }
 
-	void writeNextBlock() {
-		std::size_t bytes_sent = blocks_sent_ * max_payload_size;
-		std::size_t remaining  = command_.data.size() - bytes_sent;
-		std::size_t block_size = std::min(remaining, max_payload_size);
-		char const * start = command_.data.data() + bytes_sent;
-		std::uint32_t block_number = blocks_sent_ + 1;
-		if (bytes_sent + block_size == command_.data.size()) block_number |= 0x8000000;
-
-		auto buffer = std::make_shared<std::vector<std::uint8_t>>();
-		encode(*buffer, makeFileRequestHeader(block_size, commands::file::write_file, request_id_, blocks_sent_ + 1));
-
-		std::array<asio::const_buffer, 2> buffer_list{{
-			asio::buffer(*buffer),
-			asio::buffer(start, block_size)
-		}};
-
-		client_->socket().async_send(buffer_list, [this, self = self(), buffer = std::move(buffer)] (std::error_code error, std::size_t) {
-			if (done_.load()) return;
-			if (error) return stopSession(Error{error, "writing block for request " + std::to_string(request_id_)});
+	/// Send (or resend) the message in flight and start the retransmission timer.
+	void sendCurrentBlock() {
+		send_time_ = std::chrono::steady_clock::now();
+		if (current_block_ == 0) {
+			client_->send(asio::buffer(write_buffer_.data(), write_buffer_.size()), [this, self = self()] (std::error_code error) {
+				stopSession(Error{error, "writing command for request " + std::to_string(request_id_)});
+			});
+		} else {
+			std::size_t offset     = (current_block_ - 1) * max_payload_size;
+			std::size_t block_size = std::min(command_.data.size() - offset, max_payload_size);
+			std::uint32_t block_number = current_block_;
+			if (current_block_ == total_blocks_) block_number |= 0x80000000;
+
+			EncodedHeader & header = block_headers_[current_block_ % 2];
+			encode(header.data(), makeFileRequestHeader(block_size, commands::file::write_file, request_id_, block_number));
+			asio::const_buffer payload = asio::buffer(command_.data.data() + offset, block_size);
+			client_->send(asio::buffer(header), payload, [this, self = self()] (std::error_code error) {
+				stopSession(Error{error, "writing block " + std::to_string(current_block_) + " for request " + std::to_string(request_id_)});
+			});
+		}
+		scheduleRetransmit();
+	}
+
+	/// Retransmit the message in flight if it isn't acknowledged in time.
+	void scheduleRetransmit() {
+		retransmit_timer_.expires_from_now(rtt_.timeout());
+		retransmit_timer_.async_wait([this, self = self(), block = current_block_] (std::error_code error) {
+			if (error || done_.load() || block != current_block_) return;
+			if (retries_ >= rtt_.options().max_retries) {
+				return stopSession(Error{std::errc::timed_out,
+					"no ack for block " + std::to_string(block) + " of request " + std::to_string(request_id_)
+					+ " after " + std::to_string(retries_) + " retransmissions, "
+					+ std::to_string(bytesAcked()) + " of " + std::to_string(command_.data.size()) + " bytes acknowledged"
+				});
+			}
+			++retries_;
+			rtt_.backoff();
+			sendCurrentBlock();
 		});
-		++blocks_sent_;
 	}
 
 	/// Called when the a response has been received.
@@ -149,13 +198,21 @@ protected:
 		if (done_.load()) return;
 		if (header.status != 0) return stopSession(commandFailed(header.status, header.extra_status));
 		if (auto error = expectSize("response data", data.size(), 0)) return stopSession(error);
-
-		// TODO: Implement retransmission logic.
 		if (auto error = expectValue("ack", header.ack, true)) return stopSession(error);
-		if (auto error = expectValue("block number", header.block_number, blocks_sent_)) return stopSession(error);
 
-		if (on_progress_) on_progress_(bytesSent(), command_.data.size());
-		if (bytesSent() >= command_.data.size()) stopSession(estd::in_place_valid);
+		// Duplicate ack of a block that was already acknowledged, probably for a retransmission.
+		std::uint32_t block = header.block_number & 0x7fffffff;
+		if (block < current_block_) return;
+		if (auto error = expectValue("block number", block, current_block_)) return stopSession(error);
+
+		// Only measure the round trip time of messages that were sent once (Karn's algorithm).
+		if (retries_ == 0) rtt_.sample(std::chrono::steady_clock::now() - send_time_);
+		retries_ = 0;
+		++current_block_;
+
+		if (on_progress_) on_progress_(bytesAcked(), command_.data.size());
+		if (current_block_ > total_blocks_) return stopSession(estd::in_place_valid);
+		sendCurrentBlock();
 	}
 
 	void resetTimeout() {
@@ -163,13 +220,17 @@ protected:
 		timer_.async_wait([this, self=self()] (std::error_code error) {
 			if (error == asio::error::operation_aborted) return;
 			if (error) return stopSession(Error(error, "waiting for reply to request " + std::to_string(request_id_)));
-			stopSession(Error(std::errc::timed_out, "waiting for reply to request " + std::to_string(request_id_)));
+			if (!done_.load()) client_->recordTimeout(request_id_);
+			stopSession(Error(std::errc::timed_out, "waiting for reply to request " + std::to_string(request_id_)
+				+ ", " + std::to_string(bytesAcked()) + " of " + std::to_string(command_.data.size()) + " bytes acknowledged"
+			));
 		});
 	}
 
 	void stopSession(Result<void> result) {
 		if (done_.exchange(true)) return;
 		timer_.cancel();
+		retransmit_timer_.cancel();
 		client_->removeHandler(handler_);
 		return on_done_(result);
 	}
@@ -181,6 +242,7 @@ void writeFile(
 	std::uint8_t request_id,
 	Command command,
 	std::chrono::milliseconds timeout,
+	RetransmitOptions const & retransmit,
 	std::function<void(Result<void>)> on_done,
 	std::function<void(std::size_t bytes_sent, std::size_t total_bytes)> on_progress
 ) {
@@ -189,6 +251,7 @@ void writeFile(
 		request_id,
 		std::forward<Command>(command),
 		timeout,
+		retransmit,
 		std::move(on_done),
 		std::move(on_progress)
 	);